@@ -19,23 +19,40 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 #include "pch.h"
 #include "API.h"
 #include "Directory.h"
+#include "InputSource.h"
+#include "ImageSource.h"
+#include "OverlaySource.h"
 #include "File.h"
 #include "SectorManager.h"
 #include "SectorDescriptors.h"
+#include "Checkpoint.h"
+#include "Trace.h"
+#include "IoStatsCollector.h"
+#include "FileEntryTemplate.h"
+#include "ImageReader.h"
+#include "ImageVerifier.h"
+#include "RawImage.h"
+#include "ImageOutput.h"
+#include "Opl.h"
+#include "VirtualImage.h"
+#include "BuildCache.h"
 #include "Util.h"
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <fstream>
 #include <algorithm>
 #include <map>
-#include <regex>
+#include <unordered_map>
+#include <memory>
 #include <cassert>
 #include <cstring>
 #include <stdio.h>
 #include <cmath>
 
 constexpr auto LOG_BLOCK_SIZE = 0x800U;
+constexpr auto VOLUME_IDENTIFIER = "CRASH";
 std::mutex progress_mut;
 std::thread* pack_thread = nullptr;
 Progress program_progress;
@@ -43,18 +60,42 @@ Progress progress_copy;
 bool progress_dirty;
 char game_path[1024];
 char dest_path[1024];
+char files_path[1024]; // Files laid over the image when repacking
+char trace_path[1024]; // Empty when packs aren't traced
 unsigned int buffer_size = 32 * 1024 * 1024U; // By default use 64 MB of file buffer
+bool checkpoint_journal = false;
+LayoutOptions layout_options;
+VerifyReport verify_report;
+bool io_stats_enabled = false;
+IoStatsCollector io_stats_collector;
+IoStats io_stats; // Copied from the collector when the pack finishes
+RawSectorMode raw_mode = RawSectorMode::RAW_OFF;
+bool opl_output = false;
+bool mapped_output = false;
+char build_cache_path[1024]; // Empty when finished images aren't cached
+bool build_cache_hashes = false;
 
 void pack(const char* game_path, const char* dest_path);
-void write_sectors(FILE* f, FileTree* ft);
-void write_file_tree(SectorManager& sm, FILE* f);
-unsigned int get_path_table_size(FileTree* ft);
+void pack_source(InputSource* source, const char* dest_path, const char* game_path = nullptr);
+void finish_pack(ProgressState state);
+void repack(const char* image_path, const char* dest_path);
+void resume(const char* game_path, const char* dest_path);
+void write_sectors(SectorManager& sm, ImageOutput* f, FileTree* ft);
+void write_file_tree(SectorManager& sm, ImageOutput* f, InputSource* source, long first_file = 0, CheckpointJournal* journal = nullptr);
+void write_end_sectors(SectorManager& sm, ImageOutput* f);
+void fill_end_of_session(SectorManager& sm, EndOfSessionDescriptor& eos);
+void write_raw_image(SectorManager& sm, ImageOutput* f, const char* dest_path, CheckpointJournal* journal);
+ImageOutput* open_image_output(SectorManager& sm, FileTree* ft, const char* dest_path, bool existing);
+char* get_image_buffer(ImageOutput* f, std::vector<char>& fallback, size_t size);
+void close_image_output(SectorManager& sm, FileTree* ft, ImageOutput* f, const char* dest_path);
+std::string get_journal_path(const char* dest_path);
 void pad_string(char* str, int offset, int size, const char pad = ' ');
-void fill_path_table(SectorManager& sm, char* buffer, FileTree* ft, bool msb = false);
-unsigned int fill_fid(SectorManager& sm, FileIdentifierDescriptor& fi, FileTreeNode* node, unsigned int cur_spec_lba, std::vector<std::pair<char*, unsigned int>>& buffers);
+void fill_path_table(SectorManager& sm, char* buffer, FileTree* ft);
+void swap_path_table(const char* l_table, char* m_table, unsigned int size);
+unsigned int write_fid(SectorManager& sm, char* buffer, FileTreeNode* node, unsigned int cur_spec_lba);
 template<typename T>
 void fill_tag_checksum(DescriptorTag& tag, T* buffer, unsigned int size = sizeof(T));
-void fill_directory_record(SectorManager& sm, FileTreeNode* node, DirectoryRecord* dir_rec, std::vector<std::string>& file_names_buf, int& index, int& needed_memory);
+void fill_directory_record(SectorManager& sm, FileTreeNode* node, char* buffer);
 
 // Helper struct to pass to the fill file entry function
 struct ImageContext {
@@ -66,10 +107,23 @@ struct ImageContext {
 	char iuea_free_impl[4] = { 0x61, 0x5, 0x0, 0x0 };
 	char iuea_cgms_impl[8] = { 0x49, 0x5, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0 };
 };
-void fill_file_fe(FILE* f, SectorManager& sm, ulong unique_id, ushort cur_spec_lba, ImageContext& context);
+void fill_file_entry_prototype(FileEntry& fe, ImageContext& context, byte file_type);
+void fill_file_fe(ImageOutput* f, SectorManager& sm, ulong unique_id, ImageContext& context);
+
+// Where a directory's records and identifiers start in their regions, once the layout is done no directory depends on another
+struct DirectoryExtent {
+	FileTreeNode* dir; // nullptr for root
+	FileTree* tree;
+	size_t records_offset;
+	size_t fids_offset;
+	unsigned int fids_size;
+};
+std::vector<DirectoryExtent> get_directory_extents(SectorManager& sm, FileTree* ft, size_t& records_size, size_t& fids_size);
+template<typename F>
+void fill_directory_extents(const std::vector<DirectoryExtent>& extents, F fill);
 
-// Launch the thread to pack
-extern "C" Progress* start_packing(const char* game_path, const char* dest_path) {
+// Copy over the received strings and launch the thread
+Progress* launch_pack_thread(void (*func)(const char*, const char*), const char* game_path, const char* dest_path) {
 	const size_t game_path_copy_size = std::min(strlen(game_path), 1023UL);
 	// Copy over the received strings
 	strncpy(::game_path, game_path, game_path_copy_size);
@@ -85,10 +139,34 @@ extern "C" Progress* start_packing(const char* game_path, const char* dest_path)
 		delete pack_thread;
 		pack_thread = nullptr;
 	}
-	pack_thread = new std::thread(pack, ::game_path, ::dest_path);
+	if (::trace_path[0] != '\0') {
+		start_trace();
+	}
+	io_stats_collector.reset();
+	pack_thread = new std::thread(func, ::game_path, ::dest_path);
 	return &progress_copy;
 }
 
+// Launch the thread to pack
+extern "C" Progress* start_packing(const char* game_path, const char* dest_path) {
+	return launch_pack_thread(pack, game_path, dest_path);
+}
+
+// Launch the thread to build a new image out of an existing one with some files replaced or added
+extern "C" Progress* start_repacking(const char* image_path, const char* files_path, const char* dest_path) {
+	const size_t files_path_copy_size = files_path == nullptr ? 0 : std::min(strlen(files_path), 1023UL);
+	if (files_path_copy_size != 0) {
+		strncpy(::files_path, files_path, files_path_copy_size);
+	}
+	::files_path[files_path_copy_size] = '\0';
+	return launch_pack_thread(repack, image_path, dest_path);
+}
+
+// Launch the thread to continue the pack that was interrupted
+extern "C" Progress* resume_packing(const char* game_path, const char* dest_path) {
+	return launch_pack_thread(resume, game_path, dest_path);
+}
+
 extern "C" Progress* poll_progress() {
 	std::lock_guard<std::mutex> guard(progress_mut);
 	if (progress_dirty) {
@@ -98,35 +176,405 @@ extern "C" Progress* poll_progress() {
 	return &progress_copy;
 }
 
+// Do everything up to the point of writing, the layout uses the same options packing would
+extern "C" PackingPlan* plan_packing(const char* game_path) {
+	InputSource* source = open_input_source(game_path);
+	FileTree* ft = source->get_files();
+	delete source;
+	if (ft == nullptr) {
+		return nullptr;
+	}
+	PackingPlan* plan = nullptr;
+	try {
+		SectorManager sm(ft, ::layout_options);
+		auto& files = sm.get_placed_files();
+		std::string root(game_path);
+		plan = new PackingPlan();
+		plan->total_sectors = sm.get_total_sectors();
+		plan->partition_start_sector = sm.get_partition_start_sector();
+		plan->data_sector = sm.get_data_sector();
+		plan->layer_break = sm.get_layer_break();
+		plan->path_table_sectors = 4 * sm.get_path_table_sectors();
+		plan->directory_record_sectors = sm.get_directory_record_sectors();
+		plan->file_identifier_sectors = sm.get_file_identifier_sectors();
+		plan->file_entry_sectors = sm.get_total_directories() + sm.get_total_files();
+		plan->pad_sectors = sm.get_pad_sectors();
+		plan->directories_amount = sm.get_total_directories();
+		plan->files_amount = files.size();
+		plan->files = new PlannedFile[files.size()];
+		std::vector<char> paths;
+		unsigned long long data_bytes = 0;
+		for (size_t i = 0; i < files.size(); ++i) {
+			auto node = files[i];
+			PlannedFile& planned = plan->files[i];
+			planned.size = node->file->GetSize();
+			planned.global_sector = sm.get_file_sector(node);
+			planned.lba = sm.get_file_lba(node);
+			planned.local_sector = sm.get_file_local_sector(node);
+			planned.sectors = node->file->GetSectorsSpace();
+			planned.path_offset = paths.size();
+			auto& path = node->file->GetPath();
+			auto relative = path.compare(0, root.size(), root) == 0 ? path.substr(root.size()) : path;
+			auto start = relative.find_first_not_of("/\\");
+			relative = start == std::string::npos ? relative : relative.substr(start);
+			paths.insert(paths.end(), relative.c_str(), relative.c_str() + relative.size() + 1);
+			data_bytes += planned.size;
+		}
+		plan->paths_size = paths.size();
+		plan->paths = new char[paths.size() + 1];
+		memcpy(plan->paths, paths.data(), paths.size());
+		plan->paths[paths.size()] = '\0';
+		// Whatever lies between the first data sector and the end of session descriptor and isn't file data is padding
+		plan->padding_bytes = (unsigned long long)(plan->total_sectors - 1 - plan->data_sector) * 2048 - data_bytes;
+	}
+	catch (const ImageMakerException&) {
+		delete plan;
+		plan = nullptr;
+	}
+	delete ft;
+	return plan;
+}
+
+extern "C" void free_packing_plan(PackingPlan* plan) {
+	if (plan == nullptr) return;
+	delete[] plan->files;
+	delete[] plan->paths;
+	delete plan;
+}
+
+// Read the image back and check it against the directory it was made from, game_path can be null to only check the structure
+extern "C" VerifyReport* verify_image(const char* image_path, const char* game_path) {
+	memset(&verify_report, 0, sizeof(VerifyReport));
+	std::vector<std::string> errors;
+	try {
+		ImageReader reader(image_path);
+		ImageVerifier verifier(reader);
+		verifier.verify_structure();
+		if (game_path != nullptr && strlen(game_path) != 0) {
+			verifier.verify_contents(game_path);
+		}
+		verify_report.errors_amount = reader.get_errors_amount();
+		verify_report.descriptors_checked = reader.get_descriptors_checked();
+		verify_report.directories_checked = verifier.get_directories_checked();
+		verify_report.files_checked = verifier.get_files_checked();
+		verify_report.bytes_compared = verifier.get_bytes_compared();
+		errors = reader.get_errors();
+	}
+	catch (const ImageMakerException& e) { // Image couldn't even be opened
+		verify_report.errors_amount = 1;
+		errors.push_back(e.what());
+	}
+	std::string messages;
+	for (auto& error : errors) {
+		messages.append(error).append("\n");
+	}
+	strncpy(verify_report.errors, messages.c_str(), sizeof(verify_report.errors) - 1);
+	verify_report.passed = verify_report.errors_amount == 0;
+	return &verify_report;
+}
+
+// Image that can be read like the one a pack would write without writing it, nullptr if the game can't be laid out
+extern "C" VirtualImage* open_virtual_image(const char* game_path) {
+	try {
+		return new VirtualImage(open_input_source(game_path), ::layout_options);
+	}
+	catch (const ImageMakerException&) {
+		return nullptr;
+	}
+}
+
+extern "C" unsigned long long get_virtual_image_size(VirtualImage* image) {
+	return image->get_size();
+}
+
+// Fails if any part of the range is past the end of the image or comes from a file that can't be read, can be called from any thread
+extern "C" bool read_virtual_image(VirtualImage* image, unsigned long long offset, unsigned int size, void* buffer) {
+	return image->read(offset, size, buffer);
+}
+
+extern "C" void close_virtual_image(VirtualImage* image) {
+	delete image;
+}
+
 extern "C" void set_file_buffer(unsigned int buffer_size) {
 	::buffer_size = buffer_size;
 }
 
+extern "C" void set_checkpoint_journal(bool enabled) {
+	::checkpoint_journal = enabled;
+}
+
+// Packs after this record a timeline of their steps into the file, nullptr or an empty path turns it off
+extern "C" void set_trace_file(const char* path) {
+	const size_t trace_path_copy_size = path == nullptr ? 0 : std::min(strlen(path), 1023UL);
+	if (trace_path_copy_size != 0) {
+		strncpy(::trace_path, path, trace_path_copy_size);
+	}
+	::trace_path[trace_path_copy_size] = '\0';
+}
+
+// Packs after this keep their images in the directory and reuse them when the same input is packed with the same options again
+// Inputs are told apart by paths, sizes and modification times, or by every file's data too with hash_contents, nullptr or an empty path turns it off
+extern "C" void set_build_cache(const char* cache_dir, bool hash_contents) {
+	const size_t cache_path_copy_size = cache_dir == nullptr ? 0 : std::min(strlen(cache_dir), 1023UL);
+	if (cache_path_copy_size != 0) {
+		strncpy(::build_cache_path, cache_dir, cache_path_copy_size);
+	}
+	::build_cache_path[cache_path_copy_size] = '\0';
+	::build_cache_hashes = hash_contents;
+}
+
+extern "C" void set_io_stats(bool enabled) {
+	::io_stats_enabled = enabled;
+}
+
+// Images are written with raw 2352 byte sectors and a cue sheet next to them unless the mode is RAW_OFF
+// Sector addresses end at 99:59:74 so raw images can hold at most 449850 sectors (~878 MB of data), bigger packs fail
+extern "C" void set_raw_output(RawSectorMode mode) {
+	::raw_mode = mode;
+}
+
+// Single file images are written through a mapping of the whole image, has no effect on Windows, for OPL parts or raw sectors
+extern "C" void set_mapped_output(bool enabled) {
+	::mapped_output = enabled;
+}
+
+// Images are written as Open PS2 Loader parts with a ul.cfg record, the destination is then the directory they go to
+extern "C" void set_opl_output(bool enabled) {
+	::opl_output = enabled;
+}
+
+// Filled in once a pack with I/O stats enabled finishes
+extern "C" IoStats* get_io_stats() {
+	return &io_stats;
+}
+
+extern "C" void set_dual_layer(bool enabled, unsigned int layer_break) {
+	::layout_options.dual_layer = enabled;
+	::layout_options.layer_break = layer_break;
+}
+
+extern "C" void set_hot_files(const char** files, unsigned int amount) {
+	::layout_options.hot_files.clear();
+	for (unsigned int i = 0; i < amount; ++i) {
+		::layout_options.hot_files.push_back(files[i]);
+	}
+}
+
+// Data of every file starts at a multiple of the alignment in the image. With the file system's block size, btrfs and XFS
+// can share the file's blocks with the source instead of copying them. Has to be a power of 2, 0 or 2048 packs files tightly
+extern "C" bool set_file_alignment(unsigned int alignment) {
+	alignment = std::max(alignment, LOG_BLOCK_SIZE);
+	if ((alignment & (alignment - 1)) != 0) {
+		return false;
+	}
+	::layout_options.file_alignment = alignment / LOG_BLOCK_SIZE;
+	return true;
+}
+
+// Profile is either a plain list of paths, one per line, or a PCSX2 log where the read files show up as cdrom0:\PATH;1
+extern "C" bool set_access_profile(const char* profile_path) {
+	::layout_options.access_profile.clear();
+	if (profile_path == nullptr || strlen(profile_path) == 0) { // Just turn it off
+		return true;
+	}
+	std::ifstream profile(profile_path);
+	if (!profile.is_open()) {
+		return false;
+	}
+	std::string line;
+	while (std::getline(profile, line)) {
+		auto upper = line;
+		std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+		auto device = upper.find("CDROM");
+		std::string path;
+		if (device != std::string::npos) {
+			auto start = upper.find(':', device);
+			if (start == std::string::npos) continue;
+			auto end = line.find_first_of(" \t\r\"',)", start + 1);
+			path = line.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+		}
+		else {
+			auto start = line.find_first_not_of(" \t");
+			auto end = line.find_last_not_of(" \t\r");
+			if (start == std::string::npos || line[start] == '#') continue;
+			path = line.substr(start, end - start + 1);
+		}
+		path = normalize_disc_path(path);
+		if (!path.empty()) {
+			::layout_options.access_profile.push_back(path);
+		}
+	}
+	return true;
+}
+
 // Start the packing
 void pack(const char* game_path, const char* dest_path) {
-	Directory dir(game_path);
+	if (strcmp(game_path, dest_path) == 0) { // Image can't be repacked onto itself
+		finish_pack(ProgressState::FAILED);
+		return;
+	}
+	pack_source(open_input_source(game_path), dest_path, game_path);
+}
+
+// Files that weren't replaced are copied from the old image as they are, it's never extracted
+void repack(const char* image_path, const char* dest_path) {
+	if (strcmp(image_path, dest_path) == 0) {
+		finish_pack(ProgressState::FAILED);
+		return;
+	}
+	InputSource* files = ::files_path[0] != '\0' ? open_input_source(::files_path) : nullptr;
+	pack_source(new OverlaySource(new ImageSource(image_path), files), dest_path);
+}
+
+// Takes ownership of the source, only sources opened from game_path can be looked up in the build cache
+void pack_source(InputSource* source, const char* dest_path, const char* game_path) {
 	update_progress(ProgressState::ENUM_FILES, 0);
-	FileTree* ft = dir.get_files();
+	TraceSpan enum_span("Enumerate files");
+	FileTree* ft = source->get_files();
+	enum_span.end();
 	if (ft == nullptr) { // No file tree was built
-		update_progress(ProgressState::FAILED, 1.0, "", true);
+		finish_pack(ProgressState::FAILED);
+		delete source;
 		return;
 	}
+	std::unique_ptr<BuildCache> cache;
+	unsigned long long fingerprint = 0;
+	if (game_path != nullptr && ::build_cache_path[0] != '\0' && !::opl_output) {
+		TraceSpan cache_span("Build cache lookup");
+		cache.reset(new BuildCache(::build_cache_path, ::build_cache_hashes));
+		if (!cache->get_fingerprint(game_path, ft, source, ::layout_options, ::raw_mode, fingerprint)) {
+			cache.reset();
+		}
+		else if (cache->restore(fingerprint, dest_path)) {
+			auto state = ProgressState::FINISHED;
+			try {
+				if (::raw_mode != RawSectorMode::RAW_OFF) {
+					write_cue_sheet(dest_path, ::raw_mode);
+				}
+			}
+			catch (const ImageMakerException&) {
+				state = ProgressState::FAILED;
+			}
+			finish_pack(state);
+			delete ft;
+			delete source;
+			return;
+		}
+		else {
+			remove(dest_path); // Could be linked to a cached image, writing through the link would change that one too
+		}
+	}
 	update_progress(ProgressState::WRITE_SECTORS, 0.1);
-	FILE* image = fopen(dest_path, "wb+");
-	// image.open(dest_path, std::ios_base::binary | std::ios_base::out);
-	write_sectors(image, ft);
-	update_progress(ProgressState::FINISHED, 1.0, "", true);
+	ImageOutput* image = nullptr;
+	CheckpointJournal* journal = nullptr;
+	try {
+		SectorManager sm(ft, ::layout_options);
+		image = open_image_output(sm, ft, dest_path, false);
+		if (::checkpoint_journal) {
+			journal = new CheckpointJournal(get_journal_path(dest_path).c_str());
+		}
+		write_sectors(sm, image, ft);
+		if (journal != nullptr) {
+			journal->record(sm, image, -1, true);
+		}
+		write_file_tree(sm, image, source, 0, journal);
+		write_end_sectors(sm, image);
+		write_raw_image(sm, image, dest_path, journal);
+		close_image_output(sm, ft, image, dest_path);
+	}
+	catch (const ImageMakerException&) { // Files can't be laid out with the current options or can't be read
+		delete image;
+		delete journal;
+		finish_pack(ProgressState::FAILED);
+		delete ft;
+		delete source;
+		return;
+	}
+	delete image;
+	if (journal != nullptr) {
+		journal->remove();
+		delete journal;
+	}
+	if (cache != nullptr) {
+		TraceSpan cache_span("Build cache store");
+		cache->store(fingerprint, dest_path);
+	}
+	finish_pack(ProgressState::FINISHED);
 	delete ft;
+	delete source;
+}
+
+// Continue the pack from the last file the journal knows was flushed
+void resume(const char* game_path, const char* dest_path) {
+	CheckpointJournal journal(get_journal_path(dest_path).c_str());
+	if (!journal.load()) { // Nothing to resume from
+		finish_pack(ProgressState::FAILED);
+		return;
+	}
+	InputSource* source = open_input_source(game_path);
+	update_progress(ProgressState::ENUM_FILES, 0);
+	TraceSpan enum_span("Enumerate files");
+	FileTree* ft = source->get_files();
+	enum_span.end();
+	if (ft == nullptr) {
+		finish_pack(ProgressState::FAILED);
+		delete source;
+		return;
+	}
+	auto& rec = journal.get_record();
+	ImageOutput* image = nullptr;
+	try {
+		SectorManager sm(ft, ::layout_options);
+		image = open_image_output(sm, ft, dest_path, true);
+		// The tree must lay out exactly the same and the image must still have everything the journal recorded
+		if (rec.layout_hash != sm.get_layout_hash() || rec.total_sectors != sm.get_total_sectors() ||
+			image->get_size() < rec.image_size || rec.image_size % 2048 != 0) {
+			throw ImageMakerException("Image doesn't match the checkpoint journal");
+		}
+		if (sm.get_layer_break() != 0) {
+			// Second layer's descriptors are a copy of what was already written at the start of the image
+			char layer_descriptors[2 * 2048];
+			image->seek(16 * 2048);
+			if (!image->read(layer_descriptors, sizeof(layer_descriptors))) {
+				throw ImageMakerException("Can't read volume descriptors from the image");
+			}
+			sm.set_layer_descriptors(layer_descriptors);
+		}
+		sm.seek_sector(image, rec.image_size / 2048);
+		auto first_file = rec.last_file + 1;
+		update_progress(ProgressState::WRITE_FILES, 0.1 + 0.8 * first_file / std::max(sm.get_total_files(), 1L));
+		write_file_tree(sm, image, source, first_file, &journal);
+		write_end_sectors(sm, image);
+		write_raw_image(sm, image, dest_path, &journal);
+		close_image_output(sm, ft, image, dest_path);
+	}
+	catch (const ImageMakerException&) {
+		delete image;
+		finish_pack(ProgressState::FAILED);
+		delete ft;
+		delete source;
+		return;
+	}
+	delete image;
+	journal.remove();
+	finish_pack(ProgressState::FINISHED);
+	delete ft;
+	delete source;
+}
+
+std::string get_journal_path(const char* dest_path) {
+	return std::string(dest_path).append(".journal");
 }
 
 // All the writing for each sector is packed into this single function(for the most part) instead of having each sector to be in its separate function
 // biggest reason is because all sectors need a very strict ordering so instead of creating a seperate function for each
 // they are just divided into regions, additionally certain sector's data can depend on others
-void write_sectors(FILE* f, FileTree* ft) {
-	SectorManager sm(ft);
+void write_sectors(SectorManager& sm, ImageOutput* f, FileTree* ft) {
+	TraceSpan span("write_sectors");
 	const char pad = ' '; // For padding with spaces
 	auto sys_ident = "PLAYSTATION";
-	auto vol_ident = "CRASH";
+	auto vol_ident = VOLUME_IDENTIFIER;
 	auto publisher_ident = "VUG";
 	auto data_prep = "P.GENDREAU";
 	auto app_ident = "PLAYSTATION";
@@ -141,6 +589,7 @@ void write_sectors(FILE* f, FileTree* ft) {
 	}
 	// Write primary descriptor ISO
 #pragma region PrimaryVolumeDescriptor_ISO writing
+	TraceSpan pvd_span("Primary volume descriptor");
 	PrimaryVolumeDescriptor_ISO pvd;
 	
 	strncpy(pvd.sys_ident, sys_ident, strlen(sys_ident));
@@ -162,25 +611,24 @@ void write_sectors(FILE* f, FileTree* ft) {
 	// Block size is always 2048(0x800)
 	pvd.log_block_size_lsb = LOG_BLOCK_SIZE;
 	pvd.log_block_size_msb = changeEndianness16(LOG_BLOCK_SIZE);
-	auto path_table_size = get_path_table_size(ft);
+	auto path_table_size = sm.get_path_table_size();
 	pvd.path_table_size_lsb = path_table_size;
 	pvd.path_table_size_msb = changeEndianness32(path_table_size);
-	// These values are hardcoded because nobody in their right mind would manage to fill more than one sector with folders, right?
+	// Type L, optional L, type M and optional M tables follow each other from sector 257, each one as many whole sectors as the table's size takes
+	auto path_table_sectors = sm.get_path_table_sectors();
 	pvd.loc_type_l_path_tbl = 257;
-	pvd.loc_opt_l_path_tbl = 258;
-	pvd.loc_type_m_path_tbl = changeEndianness32(259);
-	pvd.loc_opt_m_path_tbl = changeEndianness32(260);
+	pvd.loc_opt_l_path_tbl = 257 + path_table_sectors;
+	pvd.loc_type_m_path_tbl = changeEndianness32(257 + path_table_sectors * 2);
+	pvd.loc_opt_m_path_tbl = changeEndianness32(257 + path_table_sectors * 3);
 	// Write root directory record
+	auto root_sector = sm.get_root_directory_sector();
 	DirectoryRecord& root_rec = pvd.root;
 	root_rec.dir_rec_len = 34;
 	root_rec.ext_attr_rec_len = '\0';
-	root_rec.loc_of_ext_lsb = 261;
-	root_rec.loc_of_ext_msb = changeEndianness32(261);
-	// These are actually supposed to be calculated but I couldn't find out the exact algo but it works out if it's just set to the entire logical block size
-	auto root_len = 0x30 * 2U;
-	for (auto node : ft->tree) {
-		root_len += node->file->GetName().size() + (node->file->IsDirectory() ? 0x30 : 0x32) - node->file->GetName().size() % 2;
-	}
+	root_rec.loc_of_ext_lsb = root_sector;
+	root_rec.loc_of_ext_msb = changeEndianness32(root_sector);
+	// Length of all the root directory's records including . and ..
+	auto root_len = ft->get_directory_records_layout().data_len;
 	root_rec.data_len_lsb = root_len;
 	root_rec.data_len_msb = changeEndianness32(root_len);
 	// Hardcoding to some random date because who cares lmao
@@ -239,11 +687,19 @@ void write_sectors(FILE* f, FileTree* ft) {
 	strncpy(pvd.vol_exp_date_time, no_date, strlen(no_date) + 1);
 	strncpy(pvd.vol_effec_date_time, no_date, strlen(no_date) + 1);
 	sm.write_sector<PrimaryVolumeDescriptor_ISO>(f, &pvd, sizeof(PrimaryVolumeDescriptor_ISO));
+	pvd_span.end();
 #pragma endregion
 	// Write volume descriptor set terminator ISO
 	VolumeDescriptorSetTerminator set_terminator;
 	set_terminator.type = 0xFF;
 	sm.write_sector<VolumeDescriptorSetTerminator>(f, &set_terminator, sizeof(VolumeDescriptorSetTerminator));
+	// Dual layer discs repeat these at the start of the second layer
+	if (sm.get_layer_break() != 0) {
+		char layer_descriptors[2 * 2048] = {};
+		memcpy(layer_descriptors, &pvd, sizeof(PrimaryVolumeDescriptor_ISO));
+		memcpy(layer_descriptors + 2048, &set_terminator, sizeof(VolumeDescriptorSetTerminator));
+		sm.set_layer_descriptors(layer_descriptors);
+	}
 
 	// Write BEA1
 	BeginningExtendedAreaDescriptor beg_ext_area;
@@ -267,8 +723,6 @@ void write_sectors(FILE* f, FileTree* ft) {
 	auto dvd_gen = "DVD-ROM GENERATOR";
 	auto udf_lv_info = "*UDF LV Info";
 	auto osta_complient = "*OSTA UDF Compliant";
-	auto udf_free_ea = "*UDF FreeEASpace";
-	auto udf_cgms_info = "*UDF DVD CGMS Info";
 	char compID = 0x8; // Compression ID of 8
 	auto encoded_date = "=0<58115SCEI"; // This is an encoded date of 11:35AM 24/08/2020 with SCEI appended, I haven't managed to figure out the exact algorithm to calculate this so currently it's just hardcoded
 	char id_suff[3] = { 0x2, 0x1, 0x3 }; // This is special identifier suffix bytes that are written for certain identifiers
@@ -284,6 +738,7 @@ void write_sectors(FILE* f, FileTree* ft) {
 	twins_creation_time.year = 2004;
 	twins_creation_time.type_and_timezone = 0x121C;
 	// Write twice the same descriptors for Main and RSRV
+	TraceSpan udf_span("UDF volume descriptors");
 	for (int i = 0; i < 2; ++i) {
 		ushort cur_tag_ident = 1;
 		ushort cur_tag_desc_ver = 2;
@@ -563,35 +1018,43 @@ void write_sectors(FILE* f, FileTree* ft) {
 	pad_string((char*)avd.reserved, 0, 480, '\0');
 	fill_tag_checksum(avd_tag, &avd);
 	sm.write_sector<AnchorVolumeDescriptorPointer>(f, &avd, sizeof(AnchorVolumeDescriptorPointer));
+	udf_span.end();
 #pragma endregion
 
 #pragma region Path table L/M writing
-	// Hell yeah, I love my pure C malloc
-	uint ptz = get_path_table_size(ft);
-	char* path_table_buffer = (char*)malloc(ptz); // Buffer where all the path stuff is written to
-	memset(path_table_buffer, 0, ptz);
-
-	// Write path table L and option L
-	fill_path_table(sm, path_table_buffer, ft);
-	sm.write_sector<char>(f, path_table_buffer, ptz);
-	sm.write_sector<char>(f, path_table_buffer, ptz);
-
-	// Write path table M and option M
-	fill_path_table(sm, path_table_buffer, ft, true);
-	sm.write_sector<char>(f, path_table_buffer, ptz);
-	sm.write_sector<char>(f, path_table_buffer, ptz);
-	free(path_table_buffer);
+	TraceSpan path_table_span("Path tables");
+	// Table is built once, M is the same table with its numbers swapped to big endian
+	// Both are built where their first copy goes, L and optional L are written before M can be put together
+	std::vector<char> path_table_l_buffer;
+	std::vector<char> path_table_m_buffer;
+	auto path_table_l = get_image_buffer(f, path_table_l_buffer, path_table_sectors * 2048);
+	fill_path_table(sm, path_table_l, ft);
+	for (int copy = 0; copy < 2; ++copy) {
+		for (size_t j = 0; j < path_table_sectors; ++j) {
+			sm.write_sector<const char>(f, path_table_l + j * 2048, 2048);
+		}
+	}
+	auto path_table_m = get_image_buffer(f, path_table_m_buffer, path_table_sectors * 2048);
+	swap_path_table(path_table_l, path_table_m, path_table_size);
+	for (int copy = 0; copy < 2; ++copy) {
+		for (size_t j = 0; j < path_table_sectors; ++j) {
+			sm.write_sector<const char>(f, path_table_m + j * 2048, 2048);
+		}
+	}
+	path_table_span.end();
 #pragma endregion
 
 
 	// Write directory records
 #pragma region DirectoryRecord sectors writing
-	auto directories = sm.get_total_directories();
+	TraceSpan dir_rec_span("Directory records");
+	size_t records_size, fids_size;
+	auto extents = get_directory_extents(sm, ft, records_size, fids_size);
 	// At all times present . and .. navigation folders
 	DirectoryRecord nav_this;
 	nav_this.dir_rec_len = 48;
-	nav_this.loc_of_ext_lsb = 261;
-	nav_this.loc_of_ext_msb = changeEndianness32(261);
+	nav_this.loc_of_ext_lsb = root_sector;
+	nav_this.loc_of_ext_msb = changeEndianness32(root_sector);
 	nav_this.data_len_lsb = root_len;
 	nav_this.data_len_msb = changeEndianness32(root_len);
 	nav_this.red_date_and_time[0] = 120;
@@ -608,8 +1071,8 @@ void write_sectors(FILE* f, FileTree* ft) {
 	nav_this.file_ident = '\0';
 	DirectoryRecord nav_prev;
 	nav_prev.dir_rec_len = 48;
-	nav_prev.loc_of_ext_lsb = 261; // Root is parent of root so we nav back to root
-	nav_prev.loc_of_ext_msb = changeEndianness32(261);
+	nav_prev.loc_of_ext_lsb = root_sector; // Root is parent of root so we nav back to root
+	nav_prev.loc_of_ext_msb = changeEndianness32(root_sector);
 	nav_prev.data_len_lsb = root_len;
 	nav_prev.data_len_msb = changeEndianness32(root_len);
 	nav_prev.red_date_and_time[0] = 120;
@@ -624,143 +1087,43 @@ void write_sectors(FILE* f, FileTree* ft) {
 	nav_prev.vol_seq_num_msb = changeEndianness16(1);
 	nav_prev.file_ident_len = 1;
 	nav_prev.file_ident = 1;
-	auto cur_tree = ft;
-	FileTreeNode* cur_dir = nullptr;
-	auto prev_dir_len = root_len;
-	for (int i = 0; i < directories; ++i) {
-		auto needed_memory = 96; // Amount of needed memory for a sector
-		auto index = 0;
-		auto dir_len = 0x30 * 2U;
-		auto section = 1;
-		// Recalculate the data len of the current directory tree for nav dirs as well as set their new LBA
-		if (cur_dir != nullptr) {
-			for (auto node : cur_tree->tree) {
-				auto next_len = node->file->GetName().size() + (node->file->IsDirectory() ? 0x30 : 0x32) - node->file->GetName().size() % 2;
-				if (dir_len + next_len > 2048 * section) { // Pad to 2048
-					dir_len += (2048 - dir_len % 2048);
-					section++;
-				}
-				dir_len += next_len;
-			}
-			nav_this.data_len_lsb = dir_len;
-			nav_this.data_len_msb = changeEndianness32(dir_len);
-			nav_this.loc_of_ext_lsb = sm.get_file_sector(cur_dir);
-			nav_this.loc_of_ext_msb = changeEndianness32(sm.get_file_sector(cur_dir));
-			if (cur_dir->parent != nullptr) {
-				auto par_dir_len = 0x30 * 2U;
-				auto section = 1;
-				for (auto node : cur_dir->parent->next->tree) {
-					auto next_len = node->file->GetName().size() + (node->file->IsDirectory() ? 0x30 : 0x32) - node->file->GetName().size() % 2;
-					if (par_dir_len + next_len > 2048 * section) { // Pad to 2048
-						par_dir_len += (2048 - par_dir_len % 2048);
-						section++;
-					}
-					par_dir_len += next_len;
-				}
-				nav_prev.data_len_lsb = par_dir_len;
-				nav_prev.data_len_msb = changeEndianness32(par_dir_len);
-				nav_prev.loc_of_ext_lsb = sm.get_file_sector(cur_dir->parent);
-				nav_prev.loc_of_ext_msb = changeEndianness32(sm.get_file_sector(cur_dir->parent));
-			}
-			else {
-				nav_prev.loc_of_ext_lsb = 261;
-				nav_prev.loc_of_ext_msb = changeEndianness32(261);
-				nav_prev.data_len_lsb = root_len;
-				nav_prev.data_len_msb = changeEndianness32(root_len);
-			}
-		}
-
-		// Fill in the directory
-		DirectoryRecord* dir_rec = new DirectoryRecord[cur_tree->tree.size()];
-		std::vector<std::string> file_names_buf;
-		std::vector<FileTreeNode*> file_buf;
-		//std::vector<FileTreeNode*> dir_buf;
-		for (auto node : cur_tree->tree) {
-			// Need to process directories in root first, kick files in a buffer for now
-			if (node->file->IsDirectory() && cur_dir == nullptr) {
-				fill_directory_record(sm, node, dir_rec, file_names_buf, index, needed_memory);
-			}
-			/*else if (node->file->IsDirectory()) {
-				dir_buf.push_back(node);
-			}*/
-			else if (cur_dir == nullptr) {
-				file_buf.push_back(node);
-			}
-			else {
-				fill_directory_record(sm, node, dir_rec, file_names_buf, index, needed_memory);
-			}
-		}
-
-		// Fill in the files
-		for (auto node : file_buf) {
-			fill_directory_record(sm, node, dir_rec, file_names_buf, index, needed_memory);
-		}
-		// In every other folder than root fill directories last
-		/*for (auto node : dir_buf) {
-			fill_directory_record(sm, node, dir_rec, file_names_buf, index, needed_memory);
-		}*/
-
-		// If a single directory needs more than one sector for elements then I am sorry but you kinda gonna have to create a child directory :^)
-		//assert(needed_memory < 2048);
-		size_t needed_sectors = std::ceil(needed_memory / 2048.0);
-
-		// Write the records to memory
-		char* buffer = (char*)malloc(needed_sectors * 2048);
-		memset(buffer, 0, needed_sectors * 2048); // Init the mem to 0
-		int offset = 0;
-		// Write nav dir this
-		memcpy(buffer, &nav_this, sizeof(DirectoryRecord));
-		offset += sizeof(DirectoryRecord);
-		memset(buffer + offset, 0, nav_this.dir_rec_len - sizeof(DirectoryRecord));
-		offset += nav_this.dir_rec_len - sizeof(DirectoryRecord);
-		// Write nav dir prev
-		memcpy(buffer + offset, &nav_prev, sizeof(DirectoryRecord));
-		offset += sizeof(DirectoryRecord);
-		memset(buffer + offset, 0, nav_prev.dir_rec_len - sizeof(DirectoryRecord));
-		offset += nav_prev.dir_rec_len - sizeof(DirectoryRecord);
-		int prev_sec = 0;
-		for (int j = 0; j < cur_tree->tree.size(); ++j) {
-			DirectoryRecord& rec = dir_rec[j];
-			// Write the header without the string
-			memcpy(buffer + offset, &rec, sizeof(DirectoryRecord) - 1);
-			offset += sizeof(DirectoryRecord) - 1;
-			// Write the string
-			strncpy(buffer + offset, file_names_buf[j].c_str(), rec.file_ident_len);
-			offset += rec.file_ident_len;
-			memset(buffer + offset, 0, rec.dir_rec_len - sizeof(DirectoryRecord) + 1 - rec.file_ident_len);
-			offset += rec.dir_rec_len - sizeof(DirectoryRecord) + 1 - rec.file_ident_len;
-			// Check if this isn't the last record and we don't have enough space for next record
-			if (j != cur_tree->tree.size() - 1 && (offset + dir_rec[j + 1].dir_rec_len) / 2048 > prev_sec) {
-				prev_sec = (offset + dir_rec[j + 1].dir_rec_len) / 2048;
-				// Pad the remaining bytes and move to the next sector
-				memset(buffer + offset, 0, 2048 * prev_sec - offset);
-				needed_memory += 2048 * prev_sec - offset;
-				offset += 2048 * prev_sec - offset;
+	// Every directory fills its own records in its place in the region, then the whole region is written in order
+	std::vector<char> buffer;
+	auto records_region = get_image_buffer(f, buffer, records_size);
+	fill_directory_extents(extents, [&](const DirectoryExtent& extent) {
+		auto& layout = extent.tree->get_directory_records_layout();
+		auto records = records_region + extent.records_offset;
+		// Set the nav dirs to the current directory and its parent, root's already point at itself
+		auto this_rec = nav_this;
+		auto prev_rec = nav_prev;
+		if (extent.dir != nullptr) {
+			this_rec.data_len_lsb = layout.data_len;
+			this_rec.data_len_msb = changeEndianness32(layout.data_len);
+			this_rec.loc_of_ext_lsb = sm.get_file_sector(extent.dir);
+			this_rec.loc_of_ext_msb = changeEndianness32(sm.get_file_sector(extent.dir));
+			if (extent.dir->parent != nullptr) {
+				auto par_dir_len = extent.dir->parent->next->get_directory_records_layout().data_len;
+				prev_rec.data_len_lsb = par_dir_len;
+				prev_rec.data_len_msb = changeEndianness32(par_dir_len);
+				prev_rec.loc_of_ext_lsb = sm.get_file_sector(extent.dir->parent);
+				prev_rec.loc_of_ext_msb = changeEndianness32(sm.get_file_sector(extent.dir->parent));
 			}
 		}
-
-		if (needed_memory - offset > 0) {
-			memset(buffer + offset, 0, needed_memory - offset);
-			printf("WARNING: LEFTOVER MEMORY AMOUNT %d\n", offset);
-		}
-
-		// Write the sector and free the memory
-		for (size_t j = 0; j < needed_sectors; ++j) {
-			sm.write_sector<char>(f, buffer + j * 2048, 2048);
-		}
-		free(buffer);
-		delete[] dir_rec;
-
-		// Update current tree
-		if (i != directories - 1) {
-			cur_dir = sm.get_directories()[i];
-			cur_tree = cur_dir->next;
+		memcpy(records, &this_rec, sizeof(DirectoryRecord));
+		memcpy(records + this_rec.dir_rec_len, &prev_rec, sizeof(DirectoryRecord));
+		for (size_t j = 0; j < layout.entries.size(); ++j) {
+			fill_directory_record(sm, layout.entries[j], records + layout.offsets[j]);
 		}
+	});
+	for (size_t offset = 0; offset < records_size; offset += 2048) {
+		sm.write_sector<char>(f, records_region + offset, 2048);
 	}
+	dir_rec_span.end();
 #pragma endregion
 
 	// Write file set descriptor, after this descriptor and its terminator starts special LBA addressing for tags and other stuff, this descriptor is at LBA 0
 #pragma region FileSetDescriptor writing
+	TraceSpan fsd_span("File set descriptor");
 	FileSetDescriptor fs;
 	DescriptorTag& fs_tag = fs.tag;
 	fs_tag.tag_ident = 0x100;
@@ -809,6 +1172,7 @@ void write_sectors(FILE* f, FileTree* ft) {
 	pad_string((char*)fs.reserved, 0, 48, '\0');
 	fill_tag_checksum(fs_tag, &fs);
 	sm.write_sector<FileSetDescriptor>(f, &fs, sizeof(FileSetDescriptor));
+	fsd_span.end();
 #pragma endregion
 
 
@@ -816,11 +1180,12 @@ void write_sectors(FILE* f, FileTree* ft) {
 	td_tag.tag_location = sm.get_current_sector();
 	sm.write_sector<TerminatingDescriptor>(f, &td, sizeof(TerminatingDescriptor));
 	// Start special LBA counter
-	ushort cur_spec_lba = 2;
+	uint cur_spec_lba = 2; // Partition relative, past 65535 blocks once there are enough files
 
 	// Write file identifier descriptor
 	std::map<FileTree*, unsigned int> dir_file_ident_size_map; // Used for directory entries
 #pragma region FileIdentifierDescriptors writing
+	TraceSpan fid_span("File identifiers");
 	FileIdentifierDescriptor fi_root;
 	DescriptorTag& fi_root_tag = fi_root.tag;
 	fi_root_tag.tag_ident = 0x101;
@@ -837,235 +1202,82 @@ void write_sectors(FILE* f, FileTree* ft) {
 	fi_root.len_of_impl_use = 0;
 	fi_root.impl_use = '\0';
 	fi_root.file_ident = '\0';
-	cur_tree = ft;
-	cur_dir = nullptr;
-	for (int i = 0; i < directories; ++i) {
-		// Update root's lba and its checksum
-		fi_root_tag.tag_location = cur_spec_lba;
-		fill_tag_checksum(fi_root_tag, &fi_root);
-		if (cur_dir != nullptr) {
-			fi_root.icb.extent_loc.log_block_num = sm.get_file_lba(cur_dir);
-		}
-
-		int needed_memory = sizeof(FileIdentifierDescriptor); // Root descriptor is always included
-		int index = 0;
-		FileIdentifierDescriptor* file_idents = new FileIdentifierDescriptor[cur_tree->tree.size()];
-		std::vector<FileTreeNode*> files;
-		std::vector<std::string> file_names;
-		std::vector<std::pair<char*, unsigned int>> buffers;
-		size_t needed_sectors = 1;
-		// Write folders first and files later
-		for (auto node : cur_tree->tree) {
-			if (node->file->IsDirectory() && cur_dir == nullptr) {
-				needed_memory += fill_fid(sm, file_idents[index++], node, cur_spec_lba, buffers);
-				if (std::ceil(needed_memory / 2048.0) > needed_sectors || needed_memory / 2048 == needed_sectors) { // Sector overflowing
-					cur_spec_lba++;
-					needed_sectors++;
-				}
-			}
-			else if (cur_dir == nullptr) {
-				files.push_back(node);
-			}
-			else {
-				needed_memory += fill_fid(sm, file_idents[index++], node, cur_spec_lba, buffers);
-				if (std::ceil(needed_memory / 2048.0) > needed_sectors || needed_memory / 2048 == needed_sectors) { // Sector overflowing
-					cur_spec_lba++;
-					needed_sectors++;
-				}
-			}
-		}
-
-		// Fill in the files
-		for (auto file : files) {
-			needed_memory += fill_fid(sm, file_idents[index++], file, cur_spec_lba, buffers);
-			if (std::ceil(needed_memory / 2048.0) > needed_sectors || needed_memory / 2048 == needed_sectors) { // Sector overflowing
-				cur_spec_lba++;
-				needed_sectors++;
-			}
-		}
-
-		
-		// Write the data to the sector
-		char* buffer = (char*)malloc(needed_sectors * 2048);
-		memset(buffer, 0, needed_sectors * 2048);
-		int offset = 0;
-		memcpy(buffer, &fi_root, sizeof(FileIdentifierDescriptor));
-		offset += sizeof(FileIdentifierDescriptor);
-		auto prev_sector = 0;
-		for (size_t j = 0; j < buffers.size(); ++j) {
-			auto p = buffers[j];
-			memcpy(buffer + offset, p.first, p.second);
-			offset += p.second;
-			free(p.first);
+	std::vector<char> fid_buffer;
+	auto fids_region = get_image_buffer(f, fid_buffer, fids_size);
+	fill_directory_extents(extents, [&](const DirectoryExtent& extent) {
+		auto buffer = fids_region + extent.fids_offset;
+		auto fids_lba = cur_spec_lba + extent.fids_offset / 2048;
+		// Root descriptor is always included, it points at the directory itself
+		auto root_fid = fi_root;
+		root_fid.tag.tag_location = fids_lba;
+		if (extent.dir != nullptr) {
+			root_fid.icb.extent_loc.log_block_num = sm.get_file_lba(extent.dir);
 		}
-		if (needed_memory - offset > 0) {
-			memset(buffer + offset, 0, needed_memory - offset);
-		}
-		dir_file_ident_size_map.emplace(std::pair<FileTree*, unsigned int>(cur_tree, needed_memory));
-		for (size_t j = 0; j < needed_sectors; ++j) {
-			sm.write_sector<char>(f, buffer + 2048 * j, 2048);
-		}
-		cur_spec_lba++;
-		free(buffer);
-
-		// Update current tree
-		if (i != directories - 1) {
-			cur_dir = sm.get_directories()[i];
-			cur_tree = cur_dir->next;
+		fill_tag_checksum(root_fid.tag, &root_fid);
+		memcpy(buffer, &root_fid, sizeof(FileIdentifierDescriptor));
+		// Same order as the directory records, in root folders go first and files later, every descriptor's tag points at the sector it starts in
+		unsigned int offset = sizeof(FileIdentifierDescriptor);
+		for (auto node : extent.tree->get_directory_records_layout().entries) {
+			offset += write_fid(sm, buffer + offset, node, fids_lba + offset / 2048);
 		}
+	});
+	for (auto& extent : extents) {
+		dir_file_ident_size_map.emplace(std::pair<FileTree*, unsigned int>(extent.tree, extent.fids_size));
+	}
+	for (size_t offset = 0; offset < fids_size; offset += 2048) {
+		sm.write_sector<char>(f, fids_region + offset, 2048);
 	}
+	cur_spec_lba += fids_size / 2048;
+	fid_span.end();
 #pragma endregion
 
-	char iuea_free_impl[4] = { 0x61, 0x5, 0x0, 0x0 };
-	char iuea_cgms_impl[8] = { 0x49, 0x5, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0 };
+	auto im_cxt = ImageContext();
+	im_cxt.twins_creation_time = twins_creation_time;
 	// Write file entries for directories
 #pragma region FileEntries(Directories) writing
+	TraceSpan dir_fe_span("Directory file entries");
+	FileEntry dir_prototype;
+	fill_file_entry_prototype(dir_prototype, im_cxt, 4);
+	FileEntryTemplate dir_template(dir_prototype);
 	FileEntry root_fe;
-	DescriptorTag& fe_tag = root_fe.tag;
-	fe_tag.tag_ident = 0x105;
-	fe_tag.desc_version = 2;
-	fe_tag.desc_crc_len = sizeof(FileEntry) - sizeof(DescriptorTag);
-	fe_tag.tag_location = cur_spec_lba;
-	ICBTag& fe_icb = root_fe.icb_tag;
-	fe_icb.prior_rec_num_of_direct_entries = 0;
-	fe_icb.strategy_type = 4;
-	pad_string((char*)fe_icb.strat_param, 0, 2, '\0');
-	fe_icb.num_of_entries = 1;
-	fe_icb.file_type = 4;
-	fe_icb.parent_icb_loc.log_block_num = 0;
-	fe_icb.parent_icb_loc.part_ref_num = 0;
-	fe_icb.flags = 0x630;
-	root_fe.uid = -1;
-	root_fe.gid = -1;
-	root_fe.permissions = 0x14A5;
-	root_fe.file_link_cnt = ft->get_dir_links();
-	root_fe.record_format = 0;
-	root_fe.record_disp_attrib = 0;
-	root_fe.record_len = 0;
-	root_fe.info_len = dir_file_ident_size_map.at(ft);
-	root_fe.log_blocks_rec = 1;
-	root_fe.access_time = twins_creation_time;
-	root_fe.mod_time = twins_creation_time;
-	root_fe.attrib_time = twins_creation_time;
-	root_fe.checkpoint = 1;
-	root_fe.ext_attrib_icb.extent_len = 0;
-	root_fe.ext_attrib_icb.extent_loc.log_block_num = 0;
-	root_fe.ext_attrib_icb.extent_loc.part_ref_num = 0;
-	pad_string((char*)root_fe.ext_attrib_icb.impl_use, 0, 6, '\0');
-	root_fe.impl_ident.flags = 0;
-	strncpy(root_fe.impl_ident.ident, dvd_gen, strlen(dvd_gen));
-	pad_string(root_fe.impl_ident.ident, strlen(dvd_gen), 23, '\0');
-	pad_string(root_fe.impl_ident.ident_suffix, 0, 8, '\0');
-	root_fe.unique_id = 0; // Only for root, rest start from 0x10
-	EA_HeaderDescriptor& ea = root_fe.ext_attrib_hd;
-	ea.tag.tag_ident = 0x106;
-	ea.tag.desc_version = 2;
-	ea.tag.desc_crc_len = 8;
-	ea.tag.tag_location = cur_spec_lba;
-	fill_tag_checksum(ea.tag, &ea);
-	root_fe.iuea_udf_free.impl_ident.flags = 0;
-	strncpy((char*)root_fe.iuea_udf_free.impl_ident.ident, udf_free_ea, strlen(udf_free_ea));
-	pad_string((char*)root_fe.iuea_udf_free.impl_ident.ident, strlen(udf_free_ea), 23, '\0');
-	strncpy((char*)root_fe.iuea_udf_free.impl_ident.ident_suffix, id_suff, 2);
-	pad_string((char*)root_fe.iuea_udf_free.impl_ident.ident_suffix, 2, 8, '\0');
-	strncpy((char*)root_fe.iuea_udf_free.impl_use, iuea_free_impl, 4);
-	root_fe.iuea_udf_cgms.impl_ident.flags = 0;
-	strncpy((char*)root_fe.iuea_udf_cgms.impl_ident.ident, udf_cgms_info, strlen(udf_cgms_info));
-	pad_string((char*)root_fe.iuea_udf_cgms.impl_ident.ident, strlen(udf_cgms_info), 23, '\0');
-	strncpy((char*)root_fe.iuea_udf_cgms.impl_ident.ident_suffix, id_suff, 2);
-	pad_string((char*)root_fe.iuea_udf_cgms.impl_ident.ident_suffix, 2, 8, '\0');
-	strncpy((char*)root_fe.iuea_udf_cgms.impl_use, iuea_cgms_impl, 8);
-	root_fe.alloc_desc.info_len = root_fe.info_len; // Size of file identifier descriptor for folders, size of file for files
-	root_fe.alloc_desc.log_block_num = 2; // Always 2 for root, local sector for files
-	fill_tag_checksum(fe_tag, &root_fe);
+	// Unique id is 0 only for root, rest start from 0x10, allocation is always at 2 for root
+	auto root_info_len = dir_file_ident_size_map.at(ft);
+	ulong root_log_blocks = std::ceil(root_info_len / 2048.0);
+	dir_template.fill(root_fe, cur_spec_lba, ft->get_dir_links(), root_info_len, root_log_blocks, 0, 2);
 	sm.write_sector<FileEntry>(f, &root_fe);
 	cur_spec_lba++;
-	auto dirs = sm.get_directories();
 	ulong unique_id = 0x10;
-	auto log_block_num = 3;
-	for (auto dir : dirs) {
+	auto log_block_num = 2 + root_log_blocks;
+	for (auto dir : sm.get_directories()) {
 		FileEntry fe;
-		DescriptorTag& fe_tag = fe.tag;
-		fe_tag.tag_ident = 0x105;
-		fe_tag.desc_version = 2;
-		fe_tag.desc_crc_len = 0x12C;
-		fe_tag.tag_location = cur_spec_lba;
-		ICBTag& fe_icb = fe.icb_tag;
-		fe_icb.prior_rec_num_of_direct_entries = 0;
-		fe_icb.strategy_type = 4;
-		pad_string((char*)fe_icb.strat_param, 0, 2, '\0');
-		fe_icb.num_of_entries = 1;
-		fe_icb.file_type = 4;
-		fe_icb.parent_icb_loc.log_block_num = 0;
-		fe_icb.parent_icb_loc.part_ref_num = 0;
-		fe_icb.flags = 0x630;
-		fe.uid = -1;
-		fe.gid = -1;
-		fe.permissions = 0x14A5;
-		fe.file_link_cnt = dir->next->get_dir_links();
-		fe.record_format = 0;
-		fe.record_disp_attrib = 0;
-		fe.record_len = 0;
-		fe.info_len = dir_file_ident_size_map.at(dir->next);
-		fe.log_blocks_rec = std::ceil(fe.info_len / 2048.0);
-		fe.access_time = twins_creation_time;
-		fe.mod_time = twins_creation_time;
-		fe.attrib_time = twins_creation_time;
-		fe.checkpoint = 1;
-		fe.ext_attrib_icb.extent_len = 0;
-		fe.ext_attrib_icb.extent_loc.log_block_num = 0;
-		fe.ext_attrib_icb.extent_loc.part_ref_num = 0;
-		pad_string((char*)fe.ext_attrib_icb.impl_use, 0, 6, '\0');
-		fe.impl_ident.flags = 0;
-		strncpy(fe.impl_ident.ident, dvd_gen, strlen(dvd_gen));
-		pad_string(fe.impl_ident.ident, strlen(dvd_gen), 23, '\0');
-		pad_string(fe.impl_ident.ident_suffix, 0, 8, '\0');
-		fe.unique_id = unique_id; // 0 for root, rest start from 0x10 and count up
-		EA_HeaderDescriptor& ea = fe.ext_attrib_hd;
-		ea.tag.tag_ident = 0x106;
-		ea.tag.desc_version = 2;
-		ea.tag.desc_crc_len = 8;
-		ea.tag.tag_location = cur_spec_lba;
-		fill_tag_checksum(ea.tag, &ea);
-		fe.iuea_udf_free.impl_ident.flags = 0;
-		strncpy((char*)fe.iuea_udf_free.impl_ident.ident, udf_free_ea, strlen(udf_free_ea));
-		pad_string((char*)fe.iuea_udf_free.impl_ident.ident, strlen(udf_free_ea), 23, '\0');
-		strncpy((char*)fe.iuea_udf_free.impl_ident.ident_suffix, id_suff, 2);
-		pad_string((char*)fe.iuea_udf_free.impl_ident.ident_suffix, 2, 8, '\0');
-		strncpy((char*)fe.iuea_udf_free.impl_use, iuea_free_impl, 4);
-		fe.iuea_udf_cgms.impl_ident.flags = 0;
-		strncpy((char*)fe.iuea_udf_cgms.impl_ident.ident, udf_cgms_info, strlen(udf_cgms_info));
-		pad_string((char*)fe.iuea_udf_cgms.impl_ident.ident, strlen(udf_cgms_info), 23, '\0');
-		strncpy((char*)fe.iuea_udf_cgms.impl_ident.ident_suffix, id_suff, 2);
-		pad_string((char*)fe.iuea_udf_cgms.impl_ident.ident_suffix, 2, 8, '\0');
-		strncpy((char*)fe.iuea_udf_cgms.impl_use, iuea_cgms_impl, 8);
-		fe.alloc_desc.info_len = fe.info_len; // Size of file identifier descriptor for folders, size of file for files
-		fe.alloc_desc.log_block_num = log_block_num; // Always 2 for root, local sector for files
-		log_block_num += fe.log_blocks_rec;
-		fill_tag_checksum(fe_tag, &fe);
+		auto info_len = dir_file_ident_size_map.at(dir->next);
+		ulong log_blocks = std::ceil(info_len / 2048.0);
+		dir_template.fill(fe, cur_spec_lba, dir->next->get_dir_links(), info_len, log_blocks, unique_id, log_block_num);
+		log_block_num += log_blocks;
 		sm.write_sector<FileEntry>(f, &fe);
 		cur_spec_lba++;
 		unique_id++;
 	}
+	dir_fe_span.end();
 #pragma endregion
 
 	// Write file entries for files
-	auto im_cxt = ImageContext();
-	im_cxt.twins_creation_time = twins_creation_time;
-	fill_file_fe(f, sm, unique_id, cur_spec_lba, im_cxt);
+	fill_file_fe(f, sm, unique_id, im_cxt);
+}
 
-	write_file_tree(sm, f);
-	
+void write_end_sectors(SectorManager& sm, ImageOutput* f) {
+	TraceSpan span("write_end_sectors");
 	update_progress(ProgressState::WRITE_END, program_progress.progress);
-	// Write special pad sectors
-	auto pad_sec = '\0';
-	auto pad_secs = sm.get_pad_sectors();
-	for (int i = 0; i < pad_secs; ++i) {
-		sm.write_sector(f, &pad_sec);
-	}
+	// Write special pad sectors, as well as whatever is left of the second layer's start if it had no files
+	sm.pad_to_sector(f, sm.get_total_sectors() - 1);
 
 	// Write a special end of session descriptor?
 	EndOfSessionDescriptor eos;
+	fill_end_of_session(sm, eos);
+	sm.write_sector(f, &eos);
+}
+
+void fill_end_of_session(SectorManager& sm, EndOfSessionDescriptor& eos) {
 	DescriptorTag& eos_tag = eos.tag;
 	eos_tag.tag_ident = 2;
 	eos_tag.desc_version = 2;
@@ -1076,24 +1288,153 @@ void write_sectors(FILE* f, FileTree* ft) {
 	eos.alloc_desc2.info_len = 0x8000;
 	eos.alloc_desc2.log_block_num = 0x30;
 	fill_tag_checksum(eos_tag, &eos);
-	sm.write_sector(f, &eos);
-	fclose(f);
 }
 
-void write_file_tree(SectorManager& sm, FILE* f) {
-	auto files = sm.get_files();
+// Converting overwrites what the journal describes so it's dropped first, an interrupted conversion can't be resumed
+void write_raw_image(SectorManager& sm, ImageOutput* f, const char* dest_path, CheckpointJournal* journal) {
+	if (::raw_mode == RawSectorMode::RAW_OFF) {
+		return;
+	}
+	if (!fits_raw_addresses(sm.get_total_sectors())) {
+		throw ImageMakerException("Image is too big for raw sector addresses");
+	}
+	if (journal != nullptr) {
+		journal->remove();
+	}
+	unsigned long long room;
+	f->seek(0);
+	convert_to_raw(f->get_file(room), sm.get_total_sectors(), ::raw_mode);
+	write_cue_sheet(dest_path, ::raw_mode);
+}
+
+// Destination is a directory for OPL parts, raw sectors need the whole image in a single file to be converted in place
+ImageOutput* open_image_output(SectorManager& sm, FileTree* ft, const char* dest_path, bool existing) {
+	// Found out before anything is written instead of after the whole image is packed
+	if (::raw_mode != RawSectorMode::RAW_OFF && !fits_raw_addresses(sm.get_total_sectors())) {
+		throw ImageMakerException("Image is too big for raw sector addresses");
+	}
+#ifndef _WIN32
+	if (::mapped_output && !::opl_output && ::raw_mode == RawSectorMode::RAW_OFF) {
+		return new MappedOutput(dest_path, (unsigned long long)sm.get_total_sectors() * 2048, existing);
+	}
+#endif
+	if (!::opl_output) {
+		return new FileOutput(dest_path, existing);
+	}
+	if (::raw_mode != RawSectorMode::RAW_OFF) {
+		throw ImageMakerException("OPL parts can't hold raw sectors");
+	}
+	return new SplitOutput(get_opl_part_prefix(dest_path, VOLUME_IDENTIFIER, get_opl_startup(ft)), OPL_PART_SIZE, existing);
+}
+
+// OPL only lists the game once all of its parts are complete
+void close_image_output(SectorManager& sm, FileTree* ft, ImageOutput* f, const char* dest_path) {
+	f->close();
+	if (::opl_output) {
+		auto parts = ((unsigned long long)sm.get_total_sectors() * 2048 + OPL_PART_SIZE - 1) / OPL_PART_SIZE;
+		write_opl_config(dest_path, VOLUME_IDENTIFIER, get_opl_startup(ft), parts);
+	}
+}
+
+// Lays the directories out in the order their extents are written, root and then the rest in the order of their sectors
+// Building the layouts here also means the workers only ever read them
+std::vector<DirectoryExtent> get_directory_extents(SectorManager& sm, FileTree* ft, size_t& records_size, size_t& fids_size) {
+	std::vector<DirectoryExtent> extents;
+	extents.reserve(sm.get_total_directories());
+	records_size = 0;
+	fids_size = 0;
+	auto add_extent = [&](FileTreeNode* dir, FileTree* tree) {
+		DirectoryExtent extent;
+		extent.dir = dir;
+		extent.tree = tree;
+		extent.records_offset = records_size;
+		extent.fids_offset = fids_size;
+		extent.fids_size = tree->get_file_identifiers_size();
+		records_size += tree->get_directory_records_layout().sectors * 2048;
+		fids_size += (extent.fids_size + 2047) / 2048 * 2048;
+		extents.push_back(extent);
+	};
+	add_extent(nullptr, ft);
+	for (auto dir : sm.get_directories()) {
+		add_extent(dir, dir->next);
+	}
+	return extents;
+}
+
+// Directories are handed out one at a time to all cores, small trees aren't worth the threads
+template<typename F>
+void fill_directory_extents(const std::vector<DirectoryExtent>& extents, F fill) {
+	constexpr auto DIRECTORIES_PER_THREAD = 64U;
+	auto threads_amount = std::max(1U, std::min<unsigned int>(std::thread::hardware_concurrency(), extents.size() / DIRECTORIES_PER_THREAD));
+	std::atomic<size_t> next_extent(0);
+	auto fill_extents = [&]() {
+		for (auto i = next_extent++; i < extents.size(); i = next_extent++) {
+			fill(extents[i]);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads_amount; ++i) {
+		workers.push_back(std::thread(fill_extents));
+	}
+	fill_extents();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+// Zeroed memory for the next size bytes of the image, right in the image if it's mapped and in fallback otherwise
+char* get_image_buffer(ImageOutput* f, std::vector<char>& fallback, size_t size) {
+	auto buffer = f->get_buffer(size);
+	if (buffer != nullptr) {
+		memset(buffer, 0, size);
+		return buffer;
+	}
+	fallback.assign(size, '\0');
+	return fallback.data();
+}
+
+void write_file_tree(SectorManager& sm, ImageOutput* f, InputSource* source, long first_file, CheckpointJournal* journal) {
+	TraceSpan span("write_file_tree");
+	auto& files = sm.get_placed_files();
 	auto progress_increment = 0.8 / sm.get_total_files();
 	auto max_file = std::max_element(files.begin(), files.end(), [](FileTreeNode* n1, FileTreeNode* n2) {
 		return n1->file->GetSize() < n2->file->GetSize();
 	});
-	char* read_buf = new char[::buffer_size];
-	for (auto node : files) {
+	std::vector<char> read_buf(::buffer_size);
+	for (long i = first_file; i < (long)files.size(); ++i) {
+		auto node = files[i];
 		update_progress(ProgressState::WRITE_FILES, program_progress.progress + progress_increment, node->file->GetName().c_str());
-		FILE* in_f = fopen(node->file->GetPath().c_str(), "rb");
-		sm.write_file(f, in_f, read_buf, node->file->GetSize(), ::buffer_size);
-		fclose(in_f);
+		// Files might not follow each other, e.g. when they are moved past the layer break
+		sm.pad_to_sector(f, sm.get_file_sector(node));
+		TraceSpan file_span("write_file", is_tracing() ? node->file->GetPath().c_str() : nullptr);
+		FileTiming timing = {};
+		auto open_start = ::io_stats_enabled ? io_time_us() : 0;
+		std::unique_ptr<InputStream> in(source->open(node->file));
+		if (in == nullptr) {
+			throw ImageMakerException("Can't open a file of the game");
+		}
+		if (::io_stats_enabled) {
+			timing.open_us = io_time_us() - open_start;
+		}
+		sm.write_file(f, in.get(), read_buf.data(), node->file->GetSize(), ::buffer_size, ::io_stats_enabled ? &timing : nullptr);
+		if (::io_stats_enabled) {
+			io_stats_collector.add(node->file->GetPath(), node->file->GetSize(), timing);
+		}
+		if (journal != nullptr) {
+			journal->record(sm, f, i, i == (long)files.size() - 1);
+		}
 	}
-	delete[] read_buf;
+}
+
+// Last thing every pack does, the trace has to be on the disk by the time the caller sees the pack finished
+void finish_pack(ProgressState state) {
+	if (is_tracing()) {
+		stop_trace(::trace_path);
+	}
+	if (::io_stats_enabled) {
+		io_stats_collector.fill(io_stats);
+	}
+	update_progress(state, 1.0, "", true);
 }
 
 void update_progress(ProgressState state, float progress, const char* file_name, bool finished) {
@@ -1120,26 +1461,6 @@ void update_progress(ProgressState state, float progress, const char* file_name,
 	}
 }
 
-void _get_path_table_size(FileTreeNode* node, unsigned int& size) {
-	for (auto node : node->next->tree) {
-		if (node->file->IsDirectory()) {
-			_get_path_table_size(node, size);
-			size += 8 + node->file->GetName().size() + node->file->GetName().size() % 2;
-		}
-	}
-}
-
-unsigned int get_path_table_size(FileTree* ft) {
-	auto size = 10U; // Start with 10 because Root directory is also included
-	for (auto node : ft->tree) {
-		if (node->file->IsDirectory()) {
-			_get_path_table_size(node, size);
-			size += 8 + node->file->GetName().size() + node->file->GetName().size() % 2;
-		}
-	}
-	return size;
-}
-
 // Helper function for filling a string
 void pad_string(char* str, int offset, int size, const char pad) {
 	for (int i = 0; i < size - offset; ++i) {
@@ -1147,23 +1468,19 @@ void pad_string(char* str, int offset, int size, const char pad) {
 	}
 }
 
-// Offset and start_lba are changing due to their constant calling, yeah yeah C-like code in C++ shut up :P
-void _fill_path_table(char* buffer, FileTreeNode* node, int& offset, uint start_lba, ushort par_index, bool msb) {
-	buffer[offset++] = node->file->GetName().size();
+// Offset is moved past the written entry
+void _fill_path_table(char* buffer, FileTreeNode* node, int& offset, uint start_lba, ushort par_index) {
+	auto& name = node->file->GetName();
+	buffer[offset++] = name.size();
 	buffer[offset++] = 0;
-	uint* lba = (uint*)(buffer + offset);
-	*lba = msb ? changeEndianness32(start_lba) : start_lba;
+	memcpy(buffer + offset, &start_lba, sizeof(uint));
 	offset += 4;
-	ushort par_dir_num = msb ? changeEndianness16(par_index) : par_index;
-	ushort* par_dir_num_ptr = (ushort*)(buffer + offset);
-	*par_dir_num_ptr = par_dir_num;
+	memcpy(buffer + offset, &par_index, sizeof(ushort));
 	offset += 2;
-	std::string upper = node->file->GetName();
-	std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
-	strncpy(buffer + offset, upper.c_str(), node->file->GetName().size());
-	offset += node->file->GetName().size();
+	std::transform(name.begin(), name.end(), buffer + offset, ::toupper);
+	offset += name.size();
 	// Add padding if dir name length is odd
-	if (node->file->GetName().size() % 2 == 1) {
+	if (name.size() % 2 == 1) {
 		buffer[offset++] = '\0';
 	}
 }
@@ -1171,199 +1488,212 @@ void _fill_path_table(char* buffer, FileTreeNode* node, int& offset, uint start_
 struct DirectoryDepth {
 	FileTreeNode* node;
 	int depth;
-	int par_index;
+	std::vector<std::string> path; // Names from the root, directories on the same depth are ordered by them
 };
 
-void _explore_tree(FileTreeNode* node, std::vector<DirectoryDepth>& vec, int depth) {
+void _explore_tree(FileTreeNode* node, std::vector<DirectoryDepth>& vec, int depth, const std::vector<std::string>& path) {
 	for (auto node : node->next->tree) {
 		if (node->file->IsDirectory()) {
-			_explore_tree(node, vec, depth + 1);
 			DirectoryDepth dir_depth;
 			dir_depth.depth = depth;
 			dir_depth.node = node;
-			vec.push_back(dir_depth);
+			dir_depth.path = path;
+			dir_depth.path.push_back(node->file->GetName());
+			_explore_tree(node, vec, depth + 1, dir_depth.path);
+			vec.push_back(std::move(dir_depth));
 		}
 	}
 }
 
-void fill_path_table(SectorManager& sm, char* buffer, FileTree* ft, bool msb) {
+// Path table in little endian, every directory's entry follows its parent's
+void fill_path_table(SectorManager& sm, char* buffer, FileTree* ft) {
 	// Fill in the root table
 	buffer[0] = 1; // Ident len
 	buffer[1] = 0; // ext_rec_attrib_len
-	uint lba = msb ? changeEndianness32(261) : 261;
-	uint* lba_ptr = (uint*)(buffer + 2);
-	*lba_ptr = lba;
-	ushort par_dir_num = msb ? changeEndianness16(1) : 1;
-	ushort* par_dir_num_ptr = (ushort*)(buffer + 6);
-	*par_dir_num_ptr = par_dir_num;
+	uint lba = sm.get_root_directory_sector();
+	memcpy(buffer + 2, &lba, sizeof(uint));
+	ushort par_dir_num = 1;
+	memcpy(buffer + 6, &par_dir_num, sizeof(ushort));
 	buffer[8] = 0; // Root ident
 	buffer[9] = 0; // Pad
 	std::vector<DirectoryDepth> depths;
-	std::map<FileTreeNode*, ushort> par_index_map;
-	int depth = 0;
+	std::unordered_map<FileTreeNode*, ushort> par_index_map;
 	// Explore the tree
 	for (auto node : ft->tree) {
 		if (node->file->IsDirectory()) {
-			_explore_tree(node, depths, depth + 1);
 			DirectoryDepth dir_depth;
-			dir_depth.depth = depth;
-			dir_depth.par_index = 1;
+			dir_depth.depth = 0;
 			dir_depth.node = node;
-			depths.push_back(dir_depth);
-			par_index_map.emplace(std::pair<FileTreeNode*, int>(node, 1));
+			dir_depth.path.push_back(node->file->GetName());
+			_explore_tree(node, depths, 1, dir_depth.path);
+			depths.push_back(std::move(dir_depth));
+			par_index_map.emplace(node, 1);
 		}
 	}
-	// Sort by depth
-	std::sort(depths.begin(), depths.end(), [](DirectoryDepth& dir1, DirectoryDepth& dir2) {
-		auto dir1_path = dir1.node->file->GetPath();
-		auto dir2_path = dir2.node->file->GetPath();
-
-		if (dir1.depth == dir2.depth) {
-			std::regex regexp("[\\\\/]");
-			std::sregex_token_iterator dir1_match(dir1_path.begin(), dir1_path.end(), regexp, -1);
-			std::sregex_token_iterator dir2_match(dir2_path.begin(), dir2_path.end(), regexp, -1);
-			std::sregex_token_iterator end;
-			while (dir1_match != end && dir2_match != end) {
-				if (strcmp((*dir1_match).str().c_str(), (*dir2_match).str().c_str()) != 0) {
-					return strcmp((*dir1_match).str().c_str(), (*dir2_match).str().c_str()) < 0;
-				}
-				dir1_match++;
-				dir2_match++;
-			}
+	// Sort by depth, then by the names on the way from the root
+	std::sort(depths.begin(), depths.end(), [](const DirectoryDepth& dir1, const DirectoryDepth& dir2) {
+		if (dir1.depth != dir2.depth) {
+			return dir1.depth < dir2.depth;
 		}
-		return dir1.depth < dir2.depth;
+		return dir1.path < dir2.path;
 	});
 	// Map node's children to a parent index
-	if (depths.size() != 0) {
-		ushort par_index = 2;
-		for (const auto& depth : depths) {
-			// Check for having children
-			if (depth.node->next != nullptr) {
-				for (const auto& node : depth.node->next->tree) {
-					if (node->file->IsDirectory()) {
-						par_index_map.emplace(std::pair<FileTreeNode*, int>(node, par_index));
-					}
-				}
+	ushort par_index = 2;
+	for (const auto& depth : depths) {
+		for (const auto& node : depth.node->next->tree) {
+			if (node->file->IsDirectory()) {
+				par_index_map.emplace(node, par_index);
 			}
-			par_index++;
 		}
+		par_index++;
 	}
 	// Fill table based on depth
-	if (depths.size() != 0) {
-		int offset = 10;
-		for (const auto& depth : depths) {
-			_fill_path_table(buffer, depth.node, offset, sm.get_file_sector(depth.node), par_index_map.at(depth.node), msb);
-		}
+	int offset = 10;
+	for (const auto& depth : depths) {
+		_fill_path_table(buffer, depth.node, offset, sm.get_file_sector(depth.node), par_index_map.at(depth.node));
+	}
+}
+
+// M table has the same entries in the same places, only the extent location and the parent number are big endian
+void swap_path_table(const char* l_table, char* m_table, unsigned int size) {
+	memcpy(m_table, l_table, size);
+	unsigned int offset = 0;
+	while (offset + 8 <= size && m_table[offset] != 0) {
+		uint lba;
+		ushort parent;
+		memcpy(&lba, m_table + offset + 2, sizeof(uint));
+		memcpy(&parent, m_table + offset + 6, sizeof(ushort));
+		lba = changeEndianness32(lba);
+		parent = changeEndianness16(parent);
+		memcpy(m_table + offset + 2, &lba, sizeof(uint));
+		memcpy(m_table + offset + 6, &parent, sizeof(ushort));
+		auto ident_len = (unsigned char)m_table[offset];
+		offset += 8 + ident_len + ident_len % 2;
 	}
 }
 
-// Helper function to fill FileIdentifierDescriptor struct
-unsigned int fill_fid(SectorManager& sm, FileIdentifierDescriptor& fi, FileTreeNode* node, unsigned int cur_spec_lba, std::vector<std::pair<char*, unsigned int>>& buffers) {
-	DescriptorTag& tag = fi.tag;
-	auto file_name_size = node->file->GetName().size();
-	auto file_str_len = file_name_size * 2 + 1; // 1 additional byte for unicode compression id
-	auto struct_size = sizeof(FileIdentifierDescriptor) - 1 + file_str_len + (file_name_size % 2) * 2;
+// Helper function to write FileIdentifierDescriptor straight to its place in the directory's buffer, buffer has to be zeroed
+unsigned int write_fid(SectorManager& sm, char* buffer, FileTreeNode* node, unsigned int cur_spec_lba) {
+	auto& name = node->file->GetName();
+	auto file_name_size = name.size();
+	auto struct_size = node->get_file_identifier_length();
+	auto fi = (FileIdentifierDescriptor*)buffer;
+	DescriptorTag& tag = fi->tag;
 	tag.tag_ident = 0x101;
 	tag.desc_version = 2;
+	tag.tag_serial = 0;
 	tag.tag_location = cur_spec_lba;
 	tag.desc_crc_len = struct_size - sizeof(DescriptorTag);
-	fi.file_ver_num = 1;
-	fi.file_chars = node->file->IsDirectory() ? 2 : 0;
-	fi.len_of_file_ident = file_str_len;
-	fi.icb.extent_len = 0x13C;
-	fi.icb.extent_loc.log_block_num = sm.get_file_lba(node);
-	fi.icb.extent_loc.part_ref_num = 0;
-	pad_string((char*)fi.icb.impl_use, 0, 6, '\0');
-	fi.len_of_impl_use = 0;
-	fi.impl_use = 0x10;
-	fi.file_ident = '\0';
-	auto f_buf_len = (file_name_size + file_name_size % 2) * 2;
-	auto f_name_buf = new char[f_buf_len];
-	std::string udf_comp({ 0x8 });
-	udf_comp.append(node->file->GetName());
-	if (file_name_size % 2 != 0) {
-		udf_comp.append({'\0'});
-	}
-	UncompressUnicode(udf_comp.size(), (unsigned char*)udf_comp.c_str(), (unicode_t*)f_name_buf);
-	char* str_buf = (char*)malloc(struct_size);
-	// First write the whole main struct without descriptor tag to allow tag calculate the checksum
-	memcpy(str_buf + sizeof(DescriptorTag), ((char*)&fi) + sizeof(DescriptorTag), sizeof(FileIdentifierDescriptor) - sizeof(DescriptorTag));
-	memcpy(str_buf + sizeof(FileIdentifierDescriptor), f_name_buf, f_buf_len);
-	fill_tag_checksum(tag, str_buf, struct_size);
-	// Write the tag at the end
-	memcpy(str_buf, &tag, sizeof(DescriptorTag));
-	buffers.push_back(std::pair<char*, unsigned int>(str_buf, struct_size));
-	// At the moment the only buffer we can free because it's copied everywhere necessary and not needed anymore
-	delete[] f_name_buf;
+	fi->file_ver_num = 1;
+	fi->file_chars = node->file->IsDirectory() ? 2 : 0;
+	fi->len_of_file_ident = file_name_size * 2 + 1; // 1 additional byte for unicode compression id
+	fi->icb.extent_len = 0x13C;
+	fi->icb.extent_loc.log_block_num = sm.get_file_lba(node);
+	fi->icb.extent_loc.part_ref_num = 0;
+	fi->len_of_impl_use = 0;
+	fi->impl_use = 0x10; // Compression id, name follows as 16 bit characters
+	// Each character goes after a zero high byte, the very first high byte is file_ident
+	auto name_buf = (unsigned char*)buffer + sizeof(FileIdentifierDescriptor);
+	for (size_t i = 0; i < file_name_size; ++i) {
+		name_buf[i * 2] = name[i];
+	}
+	fill_tag_checksum(tag, buffer, struct_size);
 	return struct_size;
 }
 
+// Everything in a FileEntry that is the same for all entries of the same type, file type is 4 for directories and 5 for files
+void fill_file_entry_prototype(FileEntry& fe, ImageContext& context, byte file_type)
+{
+	DescriptorTag& fe_tag = fe.tag;
+	fe_tag.tag_ident = 0x105;
+	fe_tag.desc_version = 2;
+	fe_tag.desc_crc_len = sizeof(FileEntry) - sizeof(DescriptorTag);
+	fe_tag.tag_location = 0;
+	ICBTag& fe_icb = fe.icb_tag;
+	fe_icb.prior_rec_num_of_direct_entries = 0;
+	fe_icb.strategy_type = 4;
+	pad_string((char*)fe_icb.strat_param, 0, 2, '\0');
+	fe_icb.num_of_entries = 1;
+	fe_icb.file_type = file_type;
+	fe_icb.parent_icb_loc.log_block_num = 0;
+	fe_icb.parent_icb_loc.part_ref_num = 0;
+	fe_icb.flags = 0x630;
+	fe.uid = -1;
+	fe.gid = -1;
+	fe.permissions = 0x14A5;
+	fe.file_link_cnt = 1;
+	fe.record_format = 0;
+	fe.record_disp_attrib = 0;
+	fe.record_len = 0;
+	fe.info_len = 0;
+	fe.log_blocks_rec = 0;
+	fe.access_time = context.twins_creation_time;
+	fe.mod_time = context.twins_creation_time;
+	fe.attrib_time = context.twins_creation_time;
+	fe.checkpoint = 1;
+	fe.ext_attrib_icb.extent_len = 0;
+	fe.ext_attrib_icb.extent_loc.log_block_num = 0;
+	fe.ext_attrib_icb.extent_loc.part_ref_num = 0;
+	pad_string((char*)fe.ext_attrib_icb.impl_use, 0, 6, '\0');
+	fe.impl_ident.flags = 0;
+	strncpy(fe.impl_ident.ident, context.dvd_gen, strlen(context.dvd_gen));
+	pad_string(fe.impl_ident.ident, strlen(context.dvd_gen), 23, '\0');
+	pad_string(fe.impl_ident.ident_suffix, 0, 8, '\0');
+	fe.unique_id = 0;
+	EA_HeaderDescriptor& ea = fe.ext_attrib_hd;
+	ea.tag.tag_ident = 0x106;
+	ea.tag.desc_version = 2;
+	ea.tag.desc_crc_len = 8;
+	ea.tag.tag_location = 0;
+	fill_tag_checksum(ea.tag, &ea);
+	fe.iuea_udf_free.impl_ident.flags = 0;
+	strncpy((char*)fe.iuea_udf_free.impl_ident.ident, context.udf_free_ea, strlen(context.udf_free_ea));
+	pad_string((char*)fe.iuea_udf_free.impl_ident.ident, strlen(context.udf_free_ea), 23, '\0');
+	strncpy((char*)fe.iuea_udf_free.impl_ident.ident_suffix, context.id_suff, 2);
+	pad_string((char*)fe.iuea_udf_free.impl_ident.ident_suffix, 2, 8, '\0');
+	strncpy((char*)fe.iuea_udf_free.impl_use, context.iuea_free_impl, 4);
+	fe.iuea_udf_cgms.impl_ident.flags = 0;
+	strncpy((char*)fe.iuea_udf_cgms.impl_ident.ident, context.udf_cgms_info, strlen(context.udf_cgms_info));
+	pad_string((char*)fe.iuea_udf_cgms.impl_ident.ident, strlen(context.udf_cgms_info), 23, '\0');
+	strncpy((char*)fe.iuea_udf_cgms.impl_ident.ident_suffix, context.id_suff, 2);
+	pad_string((char*)fe.iuea_udf_cgms.impl_ident.ident_suffix, 2, 8, '\0');
+	strncpy((char*)fe.iuea_udf_cgms.impl_use, context.iuea_cgms_impl, 8);
+	fe.alloc_desc.info_len = 0;
+	fe.alloc_desc.log_block_num = 0;
+}
+
 // Helper function for writing File Entries for files
-void fill_file_fe(FILE* f, SectorManager& sm, ulong unique_id, ushort cur_spec_lba, ImageContext& context)
+void fill_file_fe(ImageOutput* f, SectorManager& sm, ulong unique_id, ImageContext& context)
 {
-	auto files = sm.get_files();
+	TraceSpan span("File entries");
+	FileEntry prototype;
+	fill_file_entry_prototype(prototype, context, 5);
+	FileEntryTemplate file_template(prototype);
+	auto& files = sm.get_files();
+	char buffer[2048] = {}; // Entry grows by a descriptor for every extra extent
+	auto& fe = *(FileEntry*)buffer;
 	for (auto file : files) {
-		FileEntry fe;
-		DescriptorTag& fe_tag = fe.tag;
-		fe_tag.tag_ident = 0x105;
-		fe_tag.desc_version = 2;
-		fe_tag.desc_crc_len = sizeof(FileEntry) - sizeof(DescriptorTag);
-		fe_tag.tag_location = cur_spec_lba;
-		ICBTag& fe_icb = fe.icb_tag;
-		fe_icb.prior_rec_num_of_direct_entries = 0;
-		fe_icb.strategy_type = 4;
-		pad_string((char*)fe_icb.strat_param, 0, 2, '\0');
-		fe_icb.num_of_entries = 1;
-		fe_icb.file_type = 5;
-		fe_icb.parent_icb_loc.log_block_num = 0;
-		fe_icb.parent_icb_loc.part_ref_num = 0;
-		fe_icb.flags = 0x630;
-		fe.uid = -1;
-		fe.gid = -1;
-		fe.permissions = 0x14A5;
-		fe.file_link_cnt = 1; // Always 1 for files
-		fe.record_format = 0;
-		fe.record_disp_attrib = 0;
-		fe.record_len = 0;
-		fe.info_len = file->file->GetSize();
-		fe.log_blocks_rec = file->file->GetSectorsSpace();
-		fe.access_time = context.twins_creation_time;
-		fe.mod_time = context.twins_creation_time;
-		fe.attrib_time = context.twins_creation_time;
-		fe.checkpoint = 1;
-		fe.ext_attrib_icb.extent_len = 0;
-		fe.ext_attrib_icb.extent_loc.log_block_num = 0;
-		fe.ext_attrib_icb.extent_loc.part_ref_num = 0;
-		pad_string((char*)fe.ext_attrib_icb.impl_use, 0, 6, '\0');
-		fe.impl_ident.flags = 0;
-		strncpy(fe.impl_ident.ident, context.dvd_gen, strlen(context.dvd_gen));
-		pad_string(fe.impl_ident.ident, strlen(context.dvd_gen), 23, '\0');
-		pad_string(fe.impl_ident.ident_suffix, 0, 8, '\0');
-		fe.unique_id = unique_id; // 0 for root, rest start from 0x10 and count up
-		EA_HeaderDescriptor& ea = fe.ext_attrib_hd;
-		ea.tag.tag_ident = 0x106;
-		ea.tag.desc_version = 2;
-		ea.tag.desc_crc_len = 8;
-		ea.tag.tag_location = cur_spec_lba;
-		fill_tag_checksum(ea.tag, &ea);
-		fe.iuea_udf_free.impl_ident.flags = 0;
-		strncpy((char*)fe.iuea_udf_free.impl_ident.ident, context.udf_free_ea, strlen(context.udf_free_ea));
-		pad_string((char*)fe.iuea_udf_free.impl_ident.ident, strlen(context.udf_free_ea), 23, '\0');
-		strncpy((char*)fe.iuea_udf_free.impl_ident.ident_suffix, context.id_suff, 2);
-		pad_string((char*)fe.iuea_udf_free.impl_ident.ident_suffix, 2, 8, '\0');
-		strncpy((char*)fe.iuea_udf_free.impl_use, context.iuea_free_impl, 4);
-		fe.iuea_udf_cgms.impl_ident.flags = 0;
-		strncpy((char*)fe.iuea_udf_cgms.impl_ident.ident, context.udf_cgms_info, strlen(context.udf_cgms_info));
-		pad_string((char*)fe.iuea_udf_cgms.impl_ident.ident, strlen(context.udf_cgms_info), 23, '\0');
-		strncpy((char*)fe.iuea_udf_cgms.impl_ident.ident_suffix, context.id_suff, 2);
-		pad_string((char*)fe.iuea_udf_cgms.impl_ident.ident_suffix, 2, 8, '\0');
-		strncpy((char*)fe.iuea_udf_cgms.impl_use, context.iuea_cgms_impl, 8);
-		fe.alloc_desc.info_len = fe.info_len; // Size of file identifier descriptor for folders, size of file for files
-		fe.alloc_desc.log_block_num = sm.get_file_local_sector(file); // Always 2 for root, local sector for files
-		fill_tag_checksum(fe_tag, &fe);
-		sm.write_sector<FileEntry>(f, &fe);
-		cur_spec_lba++;
+		auto size = file->file->GetSize();
+		auto local_sector = sm.get_file_local_sector(file);
+		// Links are always 1 for files, allocation is at the file's local sector, entries follow each other in LBA order
+		file_template.fill(fe, sm.get_file_lba(file), 1, size, file->file->GetSectorsSpace(), unique_id, local_sector);
 		unique_id++;
+		auto extents = get_extents_amount(size);
+		if (extents == 1) {
+			sm.write_sector<FileEntry>(f, &fe);
+			continue;
+		}
+		// Data is still contiguous, every extent but the last one is as long as an extent can be
+		auto ads = &fe.alloc_desc;
+		for (unsigned int i = 0; i < extents; ++i) {
+			ads[i].info_len = (uint)std::min<unsigned long long>(MAX_EXTENT_SIZE, size - (unsigned long long)i * MAX_EXTENT_SIZE);
+			ads[i].log_block_num = local_sector + i * (MAX_EXTENT_SIZE / 2048);
+		}
+		auto fe_size = sizeof(FileEntry) + (extents - 1) * sizeof(AllocDescriptor);
+		fe.len_of_alloc_desc = extents * sizeof(AllocDescriptor);
+		fe.tag.desc_crc_len = fe_size - sizeof(DescriptorTag);
+		fill_tag_checksum(fe.tag, buffer, fe_size);
+		sm.write_sector<char>(f, buffer, fe_size); // Template rewrites the fixed part for the next entry, extra descriptors are only written with their own
 	}
 }
 
@@ -1377,25 +1707,15 @@ void fill_tag_checksum(DescriptorTag& tag, T* buffer, unsigned int size)
 	tag.tag_checksum = tag_cksum;
 }
 
-void fill_directory_record(SectorManager& sm, FileTreeNode* node, DirectoryRecord* dir_rec, std::vector<std::string>& file_names_buf, int& index, int& needed_memory) {
+// Record is written straight into the directory's extent, buffer must be zeroed
+void fill_directory_record(SectorManager& sm, FileTreeNode* node, char* buffer) {
 	auto file = node->file;
-	DirectoryRecord& rec = dir_rec[index++];
-	rec.dir_rec_len = 48 + file->GetName().size() - (file->GetName().size() % 2) + (file->IsDirectory() ? 0 : 2);
-	needed_memory += rec.dir_rec_len;
+	DirectoryRecord rec;
+	rec.dir_rec_len = node->get_directory_record_length();
 	rec.loc_of_ext_lsb = sm.get_file_sector(node);
 	rec.loc_of_ext_msb = changeEndianness32(sm.get_file_sector(node));
 	if (file->IsDirectory()) {
-		auto rec_len = 0x30 * 2U;
-		auto section = 1;
-		for (auto node : node->next->tree) {
-			auto next_len = node->file->GetName().size() - node->file->GetName().size() % 2;
-			next_len += (node->file->IsDirectory() ? 0x30 : 0x32);
-			if (rec_len + next_len > 2048 * section) { // Pad to 2048
-				rec_len += (2048 - rec_len % 2048);
-				section++;
-			}
-			rec_len += next_len;
-		}
+		auto rec_len = node->next->get_directory_records_layout().data_len;
 		rec.data_len_lsb = rec_len;
 		rec.data_len_msb = changeEndianness32(rec_len);
 	}
@@ -1414,10 +1734,12 @@ void fill_directory_record(SectorManager& sm, FileTreeNode* node, DirectoryRecor
 	rec.vol_seq_num_lsb = 1;
 	rec.vol_seq_num_msb = changeEndianness16(1);
 	rec.file_ident_len = file->GetName().size() + (file->IsDirectory() ? 0 : 2);
-	rec.file_ident = '\0'; // These are set in memory directly
-	auto f_name = file->IsDirectory() ? file->GetName() : file->GetName().append(";1");
-	auto _pad = '\0';
-	if (rec.file_ident_len % 2 != 0) f_name.append(&_pad);
-	std::transform(f_name.begin(), f_name.end(), f_name.begin(), ::toupper);
-	file_names_buf.push_back(f_name);
+	// Header goes without the string, name is set in memory directly
+	memcpy(buffer, &rec, sizeof(DirectoryRecord) - 1);
+	auto& name = file->GetName();
+	auto name_start = buffer + sizeof(DirectoryRecord) - 1;
+	std::transform(name.begin(), name.end(), name_start, ::toupper);
+	if (!file->IsDirectory()) {
+		memcpy(name_start + name.size(), ";1", 2);
+	}
 }
@@ -25,6 +25,9 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 #endif
 #endif
 
+struct LayoutOptions;
+class VirtualImage;
+
 enum ProgressState {
 	FAILED = -1,
 	ENUM_FILES,
@@ -34,6 +37,13 @@ enum ProgressState {
 	FINISHED,
 };
 
+// Sector layout of the written image, raw modes write 2352 byte CD sectors with EDC/ECC
+enum RawSectorMode {
+	RAW_OFF,
+	RAW_MODE1,
+	RAW_MODE2_FORM1,
+};
+
 extern "C" struct DLLEXPORT Progress {
 	char file_name[256];
 	int size;
@@ -44,12 +54,117 @@ extern "C" struct DLLEXPORT Progress {
 	bool new_file;
 };
 
+// Where a single file ends up, path is stored at path_offset in PackingPlan::paths
+extern "C" struct DLLEXPORT PlannedFile {
+	unsigned long long size;
+	unsigned int global_sector;
+	unsigned int lba;
+	unsigned int local_sector;
+	unsigned int sectors;
+	unsigned int path_offset;
+};
+
+// Layout of an image without writing it, everything is plain data so it can be dumped and loaded as is
+extern "C" struct DLLEXPORT PackingPlan {
+	unsigned int total_sectors;
+	unsigned int partition_start_sector;
+	unsigned int data_sector; // First sector of file data
+	unsigned int layer_break; // 0 for single layer
+	unsigned int path_table_sectors;
+	unsigned int directory_record_sectors;
+	unsigned int file_identifier_sectors;
+	unsigned int file_entry_sectors;
+	unsigned int pad_sectors;
+	unsigned long long padding_bytes; // Bytes that don't hold any data, sector alignment of files, gaps and pad sectors
+	unsigned int directories_amount;
+	unsigned int files_amount; // Amount of entries in files, ordered by global_sector
+	unsigned int paths_size;
+	PlannedFile* files;
+	char* paths; // Null terminated paths relative to the root
+};
+
+// Result of reading an image back
+extern "C" struct DLLEXPORT VerifyReport {
+	bool passed;
+	unsigned int errors_amount;
+	unsigned int descriptors_checked;
+	unsigned int directories_checked;
+	unsigned int files_checked;
+	unsigned long long bytes_compared;
+	char errors[2048]; // First errors that were found, one per line
+};
+
+// Time a single file took while packing, in microseconds
+extern "C" struct DLLEXPORT FileIoTime {
+	char path[256]; // Cut to fit
+	unsigned long long size;
+	unsigned long long open_us;
+	unsigned long long read_us; // Includes data the kernel copied straight into the image
+	unsigned long long write_us;
+};
+
+// Per file I/O times of the last pack, bucket 0 of a histogram counts files under 1 us and bucket i the ones from 2^(i-1) up to 2^i us
+extern "C" struct DLLEXPORT IoStats {
+	unsigned int files_amount;
+	unsigned long long bytes;
+	unsigned long long open_us;
+	unsigned long long read_us;
+	unsigned long long write_us;
+	unsigned int open_histogram[32];
+	unsigned int read_histogram[32];
+	unsigned int write_histogram[32];
+	unsigned int slow_files_amount;
+	FileIoTime slow_files[16]; // Slowest by open, read and write time together, slowest first
+};
+
 extern "C" DLLEXPORT Progress* start_packing(const char* game_path, const char* dest_path);
 
+extern "C" DLLEXPORT Progress* start_repacking(const char* image_path, const char* files_path, const char* dest_path);
+
+extern "C" DLLEXPORT Progress* resume_packing(const char* game_path, const char* dest_path);
+
 extern "C" DLLEXPORT void set_file_buffer(unsigned int buffer_size);
 
+extern "C" DLLEXPORT void set_checkpoint_journal(bool enabled);
+
+extern "C" DLLEXPORT void set_trace_file(const char* path);
+
+extern "C" DLLEXPORT void set_build_cache(const char* cache_dir, bool hash_contents);
+
+extern "C" DLLEXPORT void set_io_stats(bool enabled);
+
+extern "C" DLLEXPORT IoStats* get_io_stats();
+
+extern "C" DLLEXPORT void set_raw_output(RawSectorMode mode);
+
+extern "C" DLLEXPORT void set_opl_output(bool enabled);
+
+extern "C" DLLEXPORT void set_mapped_output(bool enabled);
+
+extern "C" DLLEXPORT void set_dual_layer(bool enabled, unsigned int layer_break);
+
+extern "C" DLLEXPORT void set_hot_files(const char** files, unsigned int amount);
+
+extern "C" DLLEXPORT bool set_access_profile(const char* profile_path);
+
+extern "C" DLLEXPORT bool set_file_alignment(unsigned int alignment);
+
 extern "C" DLLEXPORT Progress* poll_progress();
 
+extern "C" DLLEXPORT PackingPlan* plan_packing(const char* game_path);
+
+extern "C" DLLEXPORT void free_packing_plan(PackingPlan* plan);
+
+extern "C" DLLEXPORT VerifyReport* verify_image(const char* image_path, const char* game_path);
+
+extern "C" DLLEXPORT VirtualImage* open_virtual_image(const char* game_path);
+
+extern "C" DLLEXPORT unsigned long long get_virtual_image_size(VirtualImage* image);
+
+extern "C" DLLEXPORT bool read_virtual_image(VirtualImage* image, unsigned long long offset, unsigned int size, void* buffer);
+
+extern "C" DLLEXPORT void close_virtual_image(VirtualImage* image);
+
 void update_progress(ProgressState message, float progress, const char* file_name = "", bool finished = false);
 
 extern Progress program_progress;
@@ -58,3 +173,5 @@ extern bool progress_dirty;
 extern char game_path[1024];
 extern char dest_path[1024];
 extern unsigned int buffer_size;
+extern bool checkpoint_journal;
+extern LayoutOptions layout_options;
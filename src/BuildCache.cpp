@@ -0,0 +1,313 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "BuildCache.h"
+#include "SectorManager.h"
+#include "InputSource.h"
+#include "Directory.h"
+#include "File.h"
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+constexpr auto BUILD_CACHE_VERSION = "PS2ImageMaker build cache 3"; // Changed whenever the same input would give different bytes
+constexpr auto CACHE_BUFFER_SIZE = 1024 * 1024U; // For content hashes and plain copies
+
+// Size and modification time of a file on the disk, a cached image that doesn't match its stamp was changed after it was stored
+struct FileStamp {
+	unsigned long long size;
+	long long modified_time;
+};
+
+static bool _get_stamp(const char* path, FileStamp& stamp);
+static bool _is_same_file(const char* path1, const char* path2);
+static bool _clone_file(const char* src_path, const char* dest_path);
+static bool _link_file(const char* src_path, const char* dest_path);
+static bool _copy_file(const char* src_path, const char* dest_path);
+static void _collect_entries(FileTree* ft, const std::string& path, std::vector<std::pair<std::string, File*>>& entries);
+
+BuildCache::BuildCache(const char* cache_dir, bool hash_contents) : cache_dir(cache_dir), hash_contents(hash_contents)
+{
+#ifdef _WIN32
+	CreateDirectoryA(cache_dir, NULL);
+#else
+	mkdir(cache_dir, 0777);
+#endif
+}
+
+// FNV-1a like SectorManager's layout hash, file data goes in a byte at a time so every bit of it reaches the whole hash
+bool BuildCache::get_fingerprint(const char* game_path, FileTree* ft, InputSource* source, const LayoutOptions& options, RawSectorMode raw_mode, unsigned long long& fingerprint)
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	auto hash_bytes = [&hash](const void* data, size_t size) {
+		auto bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001B3ULL;
+		}
+	};
+	auto hash_string = [&hash_bytes](const std::string& str) {
+		hash_bytes(str.c_str(), str.size() + 1);
+	};
+	hash_string(BUILD_CACHE_VERSION);
+
+	// Archives and images are a single file, their own stamp covers members that don't keep a time
+	FileStamp game_stamp;
+	if (!hash_contents && _get_stamp(game_path, game_stamp)) {
+		hash_bytes(&game_stamp, sizeof(FileStamp));
+	}
+
+	hash_bytes(&options.dual_layer, sizeof(options.dual_layer));
+	hash_bytes(&options.layer_break, sizeof(options.layer_break));
+	hash_bytes(&options.file_alignment, sizeof(options.file_alignment));
+	auto hot_files = options.hot_files.size();
+	hash_bytes(&hot_files, sizeof(hot_files));
+	std::for_each(options.hot_files.begin(), options.hot_files.end(), hash_string);
+	auto profile_files = options.access_profile.size();
+	hash_bytes(&profile_files, sizeof(profile_files));
+	std::for_each(options.access_profile.begin(), options.access_profile.end(), hash_string);
+	hash_bytes(&raw_mode, sizeof(raw_mode));
+
+	// Taken in enumeration order, the directory records follow it so the same files listed in another order give another image
+	std::vector<std::pair<std::string, File*>> entries;
+	_collect_entries(ft, "", entries);
+	std::vector<char> buffer;
+	for (auto& entry : entries) {
+		auto file = entry.second;
+		auto is_directory = file->IsDirectory();
+		auto size = file->GetSize();
+		auto modified_time = hash_contents ? 0 : file->GetModifiedTime(); // Data decides, a fresh checkout of the same files still hits
+		hash_string(entry.first);
+		hash_bytes(&is_directory, sizeof(is_directory));
+		hash_bytes(&size, sizeof(size));
+		hash_bytes(&modified_time, sizeof(modified_time));
+		if (!hash_contents || is_directory || size == 0) {
+			continue;
+		}
+		std::unique_ptr<InputStream> in(source->open(file));
+		if (in == nullptr) {
+			return false;
+		}
+		buffer.resize(CACHE_BUFFER_SIZE);
+		for (unsigned long long left = size; left != 0;) {
+			auto chunk = (size_t)std::min<unsigned long long>(left, CACHE_BUFFER_SIZE);
+			if (in->read(buffer.data(), chunk) != chunk) {
+				return false;
+			}
+			hash_bytes(buffer.data(), chunk);
+			left -= chunk;
+		}
+	}
+	fingerprint = hash;
+	return true;
+}
+
+// Cheapest way to give the destination the cached bytes, a clone or a hard link takes no time and no space
+bool BuildCache::restore(unsigned long long fingerprint, const char* dest_path)
+{
+	if (!_is_entry_valid(fingerprint)) {
+		return false;
+	}
+	auto image_path = _get_image_path(fingerprint);
+	if (_is_same_file(image_path.c_str(), dest_path)) { // Linked by an earlier hit and not changed since
+		return true;
+	}
+	remove(dest_path);
+	if (_clone_file(image_path.c_str(), dest_path) || _link_file(image_path.c_str(), dest_path) || _copy_file(image_path.c_str(), dest_path)) {
+		return true;
+	}
+	remove(dest_path);
+	return false;
+}
+
+// Image goes in under a temporary name first so an interrupted store never looks like an entry
+void BuildCache::store(unsigned long long fingerprint, const char* dest_path)
+{
+	auto image_path = _get_image_path(fingerprint);
+	auto temp_path = image_path + ".tmp";
+	auto stamp_path = image_path + ".stamp";
+	remove(temp_path.c_str());
+	remove(stamp_path.c_str());
+	if (!_clone_file(dest_path, temp_path.c_str()) && !_link_file(dest_path, temp_path.c_str()) && !_copy_file(dest_path, temp_path.c_str())) {
+		remove(temp_path.c_str());
+		return;
+	}
+	remove(image_path.c_str());
+	FileStamp stamp;
+	if (rename(temp_path.c_str(), image_path.c_str()) != 0 || !_get_stamp(image_path.c_str(), stamp)) {
+		remove(temp_path.c_str());
+		return;
+	}
+	FILE* f = fopen(stamp_path.c_str(), "w");
+	if (f == nullptr) {
+		return;
+	}
+	fprintf(f, "%llu %lld\n", stamp.size, stamp.modified_time);
+	fclose(f);
+}
+
+std::string BuildCache::_get_image_path(unsigned long long fingerprint)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.img", fingerprint);
+	return cache_dir + name;
+}
+
+// A hard linked image changes along with every image it was linked to, entries that were written to since are dropped
+bool BuildCache::_is_entry_valid(unsigned long long fingerprint)
+{
+	auto image_path = _get_image_path(fingerprint);
+	auto stamp_path = image_path + ".stamp";
+	FILE* f = fopen(stamp_path.c_str(), "r");
+	if (f == nullptr) {
+		return false;
+	}
+	FileStamp stored, current;
+	auto read = fscanf(f, "%llu %lld", &stored.size, &stored.modified_time);
+	fclose(f);
+	if (read == 2 && _get_stamp(image_path.c_str(), current) && current.size == stored.size && current.modified_time == stored.modified_time) {
+		return true;
+	}
+	remove(image_path.c_str());
+	remove(stamp_path.c_str());
+	return false;
+}
+
+// Only regular files have a stamp
+static bool _get_stamp(const char* path, FileStamp& stamp)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		return false;
+	}
+	stamp.size = ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	stamp.modified_time = ((long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat sb;
+	if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+		return false;
+	}
+	stamp.size = sb.st_size;
+#ifdef __APPLE__
+	stamp.modified_time = sb.st_mtimespec.tv_sec * 1000000000LL + sb.st_mtimespec.tv_nsec;
+#else
+	stamp.modified_time = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#endif
+#endif
+	return true;
+}
+
+static bool _is_same_file(const char* path1, const char* path2)
+{
+#ifdef _WIN32
+	return false;
+#else
+	struct stat sb1, sb2;
+	return stat(path1, &sb1) == 0 && stat(path2, &sb2) == 0 && sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
+#endif
+}
+
+// Shares every block with the source on btrfs and XFS, writing to either copy afterwards doesn't touch the other
+static bool _clone_file(const char* src_path, const char* dest_path)
+{
+#ifdef __linux__
+	auto in_fd = open(src_path, O_RDONLY);
+	if (in_fd < 0) {
+		return false;
+	}
+	auto out_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd < 0) {
+		close(in_fd);
+		return false;
+	}
+	auto cloned = ioctl(out_fd, FICLONE, in_fd) == 0;
+	close(in_fd);
+	close(out_fd);
+	if (!cloned) {
+		remove(dest_path);
+	}
+	return cloned;
+#else
+	return false;
+#endif
+}
+
+static bool _link_file(const char* src_path, const char* dest_path)
+{
+#ifdef _WIN32
+	return CreateHardLinkA(dest_path, src_path, NULL) != 0;
+#else
+	return link(src_path, dest_path) == 0;
+#endif
+}
+
+static bool _copy_file(const char* src_path, const char* dest_path)
+{
+#ifdef _WIN32
+	return CopyFileA(src_path, dest_path, FALSE) != 0;
+#else
+	FILE* in = fopen(src_path, "rb");
+	if (in == nullptr) {
+		return false;
+	}
+	FILE* out = fopen(dest_path, "wb");
+	if (out == nullptr) {
+		fclose(in);
+		return false;
+	}
+	std::vector<char> buffer(CACHE_BUFFER_SIZE);
+	auto copied = true;
+	size_t read;
+	while ((read = fread(buffer.data(), 1, buffer.size(), in)) != 0) {
+		if (fwrite(buffer.data(), 1, read, out) != read) {
+			copied = false;
+			break;
+		}
+	}
+	copied = copied && !ferror(in);
+	fclose(in);
+	return fclose(out) == 0 && copied;
+#endif
+}
+
+// Paths from the root of the tree, these are what end up on the disc
+static void _collect_entries(FileTree* ft, const std::string& path, std::vector<std::pair<std::string, File*>>& entries)
+{
+	for (auto node : ft->tree) {
+		auto node_path = path + node->file->GetName();
+		entries.push_back(std::make_pair(node_path, node->file));
+		if (node->file->IsDirectory()) {
+			_collect_entries(node->next, node_path + "/", entries);
+		}
+	}
+}
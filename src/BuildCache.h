@@ -0,0 +1,45 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "API.h"
+#include <string>
+
+struct FileTree;
+struct LayoutOptions;
+class InputSource;
+
+// Finished images kept under a fingerprint of everything that decides their bytes, packing the same input again only costs the enumeration
+class BuildCache
+{
+public:
+	BuildCache(const char* cache_dir, bool hash_contents);
+
+	// Paths, sizes and modification times or data of the tree plus the options, false if a file can't be read for its content hash
+	bool get_fingerprint(const char* game_path, FileTree* ft, InputSource* source, const LayoutOptions& options, RawSectorMode raw_mode, unsigned long long& fingerprint);
+	bool restore(unsigned long long fingerprint, const char* dest_path); // False on a miss, the destination isn't touched then
+	void store(unsigned long long fingerprint, const char* dest_path); // Failing to store doesn't fail the pack, the image is already done
+
+private:
+	std::string _get_image_path(unsigned long long fingerprint);
+	bool _is_entry_valid(unsigned long long fingerprint);
+
+private:
+	std::string cache_dir;
+	bool hash_contents; // Every file's data is read instead of trusting modification times
+};
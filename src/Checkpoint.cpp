@@ -0,0 +1,128 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "Checkpoint.h"
+#include "SectorManager.h"
+#include "ImageOutput.h"
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+constexpr auto CHECKPOINT_MAGIC = "PS2IMCK";
+constexpr auto CHECKPOINT_VERSION = 1U;
+constexpr auto CHECKPOINT_INTERVAL = 64 * 1024 * 1024ULL; // Don't sync the disk more often than every 64 MB of written data
+
+CheckpointJournal::CheckpointJournal(const char* path) : path(path), journal(nullptr), last_recorded_size(0)
+{
+	memset(&rec, 0, sizeof(CheckpointRecord));
+}
+
+CheckpointJournal::~CheckpointJournal()
+{
+	if (journal != nullptr) fclose(journal);
+}
+
+bool CheckpointJournal::load()
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == nullptr) {
+		return false;
+	}
+	auto read = fread(&rec, 1, sizeof(CheckpointRecord), f);
+	fclose(f);
+	if (read != sizeof(CheckpointRecord) || strncmp(rec.magic, CHECKPOINT_MAGIC, 8) != 0 || rec.version != CHECKPOINT_VERSION) {
+		return false;
+	}
+	last_recorded_size = rec.image_size;
+	return true;
+}
+
+void CheckpointJournal::record(SectorManager& sm, ImageOutput* image, int64_t last_file, bool force)
+{
+	uint64_t image_size = (uint64_t)sm.get_current_sector() * 2048;
+	if (!force && image_size - last_recorded_size < CHECKPOINT_INTERVAL) {
+		return;
+	}
+	// Image must be on the disk before the journal claims it is
+	image->sync();
+	strncpy(rec.magic, CHECKPOINT_MAGIC, 8);
+	rec.version = CHECKPOINT_VERSION;
+	rec.total_sectors = sm.get_total_sectors();
+	rec.layout_hash = sm.get_layout_hash();
+	rec.last_file = last_file;
+	rec.image_size = image_size;
+	if (journal == nullptr) {
+		journal = fopen(path.c_str(), "wb");
+		if (journal == nullptr) { // Journal is optional, the pack itself can still go on without it
+			return;
+		}
+	}
+	fseek(journal, 0, SEEK_SET);
+	fwrite(&rec, 1, sizeof(CheckpointRecord), journal);
+	sync_file(journal);
+	last_recorded_size = image_size;
+}
+
+void CheckpointJournal::remove()
+{
+	if (journal != nullptr) {
+		fclose(journal);
+		journal = nullptr;
+	}
+	::remove(path.c_str());
+}
+
+const CheckpointRecord& CheckpointJournal::get_record()
+{
+	return rec;
+}
+
+int seek_image(FILE* f, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+uint64_t get_image_size(FILE* f)
+{
+#ifdef _WIN32
+	_fseeki64(f, 0, SEEK_END);
+	return _ftelli64(f);
+#else
+	fseeko(f, 0, SEEK_END);
+	return ftello(f);
+#endif
+}
+
+// Make sure whatever was written actually reached the storage and not just the OS cache
+void sync_file(FILE* f)
+{
+	fflush(f);
+#ifdef _WIN32
+	_commit(_fileno(f));
+#else
+	fsync(fileno(f));
+#endif
+}
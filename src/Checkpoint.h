@@ -0,0 +1,58 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+class SectorManager;
+class ImageOutput;
+
+// Everything that is needed to continue an interrupted pack, written as is to the journal file
+struct CheckpointRecord {
+	char magic[8];
+	uint32_t version;
+	uint32_t total_sectors;
+	uint64_t layout_hash; // Hash of the whole layout computed by SectorManager, if anything in the tree moved the image can't be resumed
+	int64_t last_file; // Index into SectorManager::get_files() of the last file that was fully flushed, -1 if only the header sectors are done
+	uint64_t image_size; // Amount of bytes in the image that are guaranteed to be on the disk
+};
+
+class CheckpointJournal
+{
+public:
+	CheckpointJournal(const char* path);
+	~CheckpointJournal();
+
+	bool load();
+	void record(SectorManager& sm, ImageOutput* image, int64_t last_file, bool force = false);
+	void remove();
+	const CheckpointRecord& get_record();
+
+private:
+	std::string path;
+	FILE* journal;
+	CheckpointRecord rec;
+	uint64_t last_recorded_size;
+};
+
+// Helpers to move around in images that are bigger than what long can hold on some platforms
+int seek_image(FILE* f, uint64_t offset);
+uint64_t get_image_size(FILE* f);
+void sync_file(FILE* f);
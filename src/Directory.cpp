@@ -28,6 +28,7 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 #endif
 #include <vector>
 #include <cmath>
+#include <iterator>
 #include "Directory.h"
 #include "SectorDescriptors.h"
 #include "File.h"
@@ -46,7 +47,7 @@ Directory::Directory(const char* path) : path(path) {}
 FileTree* Directory::get_files() {
 #ifdef _WIN32
 	WIN32_FIND_DATAA file_info;
-	FileTree* ft = new FileTree();
+	FileTree* ft = new FileTree(true);
 	path.append("/*");
 	auto find_handle = FindFirstFileA(path.c_str(), &file_info);
 	if (find_handle != INVALID_HANDLE_VALUE) {
@@ -58,7 +59,7 @@ FileTree* Directory::get_files() {
 		return nullptr;
 	}
 #else
-	FileTree* ft = new FileTree();
+	FileTree* ft = new FileTree(true);
 	DIR* dr = opendir(path.c_str());
 	if (dr == NULL)
 	{
@@ -84,13 +85,13 @@ void enumerate_files_recursively(FileTree* ft, FileTreeNode* parent, std::string
 			auto pth = path;
 
 			pth.append(file_info.cFileName);
-			auto file = new File(file_info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY, file_info.nFileSizeLow,
-				pth.c_str(), "", file_info.cFileName);
+			auto file = new File(file_info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY, ((unsigned long long)file_info.nFileSizeHigh << 32) | file_info.nFileSizeLow,
+				pth.c_str(), "", file_info.cFileName, ((long long)file_info.ftLastWriteTime.dwHighDateTime << 32) | file_info.ftLastWriteTime.dwLowDateTime);
 			auto node = new FileTreeNode(nullptr, parent, file);
 			node->depth = depth;
 			if (file->IsDirectory()) {
 				node->next = new FileTree();
-				auto str = file->GetPath().append("/*");
+				auto str = file->GetPath() + "/*";
 				enumerate_files_recursively(node->next, node, str, depth + 1);
 			}
 			ft->tree.push_back(node);
@@ -110,7 +111,12 @@ void enumerate_files_recursively(FileTree* ft, FileTreeNode* parent, std::string
 		pth.append(dir->d_name);
 		struct stat sb;
 		lstat(pth.c_str(), &sb);
-		auto file = new File(dir->d_type & DT_DIR, sb.st_size, pth.c_str(), "", dir->d_name);
+#ifdef __APPLE__
+		auto modified_time = sb.st_mtimespec.tv_sec * 1000000000LL + sb.st_mtimespec.tv_nsec;
+#else
+		auto modified_time = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#endif
+		auto file = new File(dir->d_type & DT_DIR, sb.st_size, pth.c_str(), "", dir->d_name, modified_time);
 		auto node = new FileTreeNode(nullptr, parent, file);
 		node->depth = depth;
 		if (file->IsDirectory()) {
@@ -164,9 +170,9 @@ long FileTree::get_dir_links()
 	return amount;
 }
 
-unsigned int FileTree::get_files_size()
+unsigned long long FileTree::get_files_size()
 {
-	unsigned int size = 0U;
+	unsigned long long size = 0U;
 	for (auto node : this->tree) {
 		if (node->file->IsDirectory()) {
 			_get_files_size(node, size);
@@ -191,33 +197,49 @@ unsigned int FileTree::get_files_size()
 unsigned int FileTree::get_directory_records_amount()
 {
 	unsigned int amount = 0;
-	auto dir_rec_len = 0x60;
 	for (auto node : this->tree) {
 		if (node->file->IsDirectory()) {
 			_get_directory_records_amount(node, amount);
 		}
-		dir_rec_len += node->file->GetName().size() + (node->file->IsDirectory() ? 0x30 : 0x32) - node->file->GetName().size() % 2;
 	}
-	amount += std::ceil(dir_rec_len / 2048.0);
+	amount += get_directory_records_layout().sectors;
 	return amount;
 }
 
 unsigned int FileTree::get_file_identifiers_amount()
 {
 	unsigned int amount = 0;
-	auto file_ident_len = sizeof(FileIdentifierDescriptor);
 	for (auto node : this->tree) {
 		if (node->file->IsDirectory()) {
 			_get_file_identifiers_amount(node, amount);
 		}
-		auto file_name_size = node->file->GetName().size();
-		auto file_str_len = file_name_size * 2 + 1;
-		file_ident_len += sizeof(FileIdentifierDescriptor) - 1 + file_str_len + (file_name_size % 2) * 2;
 	}
-	amount += std::ceil(file_ident_len / 2048.0);
+	amount += std::ceil(get_file_identifiers_size() / 2048.0);
 	return amount;
 }
 
+// Descriptors may cross sector boundaries so the extent is just all of them one after another, parent's comes first
+unsigned int FileTree::get_file_identifiers_size()
+{
+	unsigned int size = sizeof(FileIdentifierDescriptor);
+	for (auto node : this->tree) {
+		size += node->get_file_identifier_length();
+	}
+	return size;
+}
+
+unsigned int FileTree::get_path_table_size()
+{
+	auto size = 10U; // Start with 10 because Root directory is also included
+	for (auto node : this->tree) {
+		if (node->file->IsDirectory()) {
+			_get_path_table_size(node, size);
+			size += 8 + node->file->GetName().size() + node->file->GetName().size() % 2;
+		}
+	}
+	return size;
+}
+
 void FileTree::_get_dir_amount(FileTreeNode* node, long& amount)
 {
 	for (auto node : node->next->tree) {
@@ -240,7 +262,7 @@ void FileTree::_get_file_amount(FileTreeNode* node, long& amount)
 	}
 }
 
-void FileTree::_get_files_size(FileTreeNode* node, unsigned int& size)
+void FileTree::_get_files_size(FileTreeNode* node, unsigned long long& size)
 {
 	for (auto node : node->next->tree) {
 		if (node->file->IsDirectory()) {
@@ -259,52 +281,91 @@ void FileTree::_get_files_size(FileTreeNode* node, unsigned int& size)
 
 void FileTree::_get_directory_records_amount(FileTreeNode* node, unsigned int& amount)
 {
-	auto dir_rec_len = 0x60;
 	for (auto node : node->next->tree) {
 		if (node->file->IsDirectory()) {
 			_get_directory_records_amount(node, amount);
 		}
-		dir_rec_len += node->file->GetName().size() + (node->file->IsDirectory() ? 0x30 : 0x32) - node->file->GetName().size() % 2;
 	}
-	amount += std::ceil(dir_rec_len / 2048.0);
+	amount += node->get_directory_records_space();
 }
 
 void FileTree::_get_file_identifiers_amount(FileTreeNode* node, unsigned int& amount)
 {
-	auto file_ident_len = sizeof(FileIdentifierDescriptor);
 	for (auto node : node->next->tree) {
 		if (node->file->IsDirectory()) {
 			_get_file_identifiers_amount(node, amount);
 		}
-		auto file_name_size = node->file->GetName().size();
-		auto file_str_len = file_name_size * 2 + 1;
-		file_ident_len += sizeof(FileIdentifierDescriptor) - 1 + file_str_len + (file_name_size % 2) * 2;
 	}
-	amount += std::ceil(file_ident_len / 2048.0);
+	amount += node->get_file_identifiers_space();
 }
 
-unsigned int FileTreeNode::get_directory_records_space()
+void FileTree::_get_path_table_size(FileTreeNode* node, unsigned int& size)
 {
-	unsigned int space = 0;
-	if (this->file->IsDirectory()) {
-		space = 0x60;
-		for (auto node : this->next->tree) {
-			space += node->file->GetName().size() + (node->file->IsDirectory() ? 0x30 : 0x32) - node->file->GetName().size() % 2;
+	for (auto node : node->next->tree) {
+		if (node->file->IsDirectory()) {
+			_get_path_table_size(node, size);
+			size += 8 + node->file->GetName().size() + node->file->GetName().size() % 2;
 		}
 	}
-	return std::ceil(space / 2048.0);
+}
+
+// Record with the XA extension, files get ;1 appended to their name
+unsigned int FileTreeNode::get_directory_record_length()
+{
+	auto name_size = this->file->GetName().size();
+	return name_size - name_size % 2 + (this->file->IsDirectory() ? 0x30 : 0x32);
+}
+
+unsigned int FileTreeNode::get_directory_records_space()
+{
+	if (!this->file->IsDirectory()) {
+		return 0;
+	}
+	return this->next->get_directory_records_layout().sectors;
+}
+
+// Name is stored as 16 bit characters after the compression id, the descriptor is padded to 4 bytes
+unsigned int FileTreeNode::get_file_identifier_length()
+{
+	auto name_size = this->file->GetName().size();
+	return sizeof(FileIdentifierDescriptor) - 1 + name_size * 2 + 1 + (name_size % 2) * 2;
 }
 
 unsigned int FileTreeNode::get_file_identifiers_space()
 {
-	unsigned int space = 0;
-	if (this->file->IsDirectory()) {
-		space = 0x60;
-		for (auto node : this->next->tree) {
-			auto file_name_size = node->file->GetName().size();
-			auto file_str_len = file_name_size * 2 + 1;
-			space += sizeof(FileIdentifierDescriptor) - 1 + file_str_len + (file_name_size % 2) * 2;
+	if (!this->file->IsDirectory()) {
+		return 0;
+	}
+	return std::ceil(this->next->get_file_identifiers_size() / 2048.0);
+}
+
+// Root lists its directories before its files, everywhere else records follow the tree
+const DirectoryRecordsLayout& FileTree::get_directory_records_layout()
+{
+	if (records_layout != nullptr) {
+		return *records_layout;
+	}
+	records_layout = new DirectoryRecordsLayout();
+	auto& layout = *records_layout;
+	layout.entries.reserve(tree.size());
+	if (root) {
+		std::copy_if(tree.begin(), tree.end(), std::back_inserter(layout.entries), [](FileTreeNode* node) { return node->file->IsDirectory(); });
+		std::copy_if(tree.begin(), tree.end(), std::back_inserter(layout.entries), [](FileTreeNode* node) { return !node->file->IsDirectory(); });
+	}
+	else {
+		layout.entries = tree;
+	}
+	layout.offsets.reserve(layout.entries.size());
+	unsigned int offset = 0x30 * 2;
+	for (auto node : layout.entries) {
+		auto length = node->get_directory_record_length();
+		if (offset / 2048 != (offset + length - 1) / 2048) { // Doesn't fit in what's left of the sector
+			offset += 2048 - offset % 2048;
 		}
+		layout.offsets.push_back(offset);
+		offset += length;
 	}
-	return std::ceil(space / 2048.0);
+	layout.data_len = offset;
+	layout.sectors = (offset + 2047) / 2048;
+	return layout;
 }
@@ -24,8 +24,15 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 class File;
 struct Progress;
 struct FileTree;
-
-
+struct FileTreeNode;
+
+// Where every entry's ISO directory record goes in its directory's extent, a record never crosses a sector boundary
+struct DirectoryRecordsLayout {
+	std::vector<FileTreeNode*> entries; // In the order their records are written
+	std::vector<unsigned int> offsets; // Of each entry's record, . and .. take the first 96 bytes
+	unsigned int data_len; // Up to the end of the last record
+	unsigned int sectors;
+};
 
 struct FileTreeNode {
 	FileTree* next;
@@ -34,35 +41,47 @@ struct FileTreeNode {
 	int links; // Amount of links to another directories
 	int depth;
 
-	FileTreeNode(FileTree* next, FileTreeNode* parent, File* file) : next(next), parent(parent), file(file), depth(0), links(1) {}
+	FileTreeNode(FileTree* next, FileTreeNode* parent, File* file) : next(next), file(file), parent(parent), links(1), depth(0) {}
 	~FileTreeNode();
 	
+	unsigned int get_directory_record_length();
 	unsigned int get_directory_records_space();
+	unsigned int get_file_identifier_length();
 	unsigned int get_file_identifiers_space();
 };
 
 struct FileTree {
 	std::vector<FileTreeNode*> tree;
 
+	FileTree(bool root = false) : root(root), records_layout(nullptr) {}
 	~FileTree() {
 		std::for_each(tree.begin(), tree.end(), [](FileTreeNode* node) { delete node; });
 		tree.clear();
+		delete records_layout;
 	}
 
 	long get_dir_amount();
 	long get_file_amount();
 	long get_content_amount();
 	long get_dir_links();
-	unsigned int get_files_size();
+	unsigned long long get_files_size();
 	unsigned int get_directory_records_amount();
 	unsigned int get_file_identifiers_amount();
+	unsigned int get_file_identifiers_size();
+	unsigned int get_path_table_size();
+	const DirectoryRecordsLayout& get_directory_records_layout();
 
 private:
 	void _get_dir_amount(FileTreeNode* node, long& amount);
 	void _get_file_amount(FileTreeNode* node, long& amount);
-	void _get_files_size(FileTreeNode* node, unsigned int& size);
+	void _get_files_size(FileTreeNode* node, unsigned long long& size);
 	void _get_directory_records_amount(FileTreeNode* node, unsigned int& amount);
 	void _get_file_identifiers_amount(FileTreeNode* node, unsigned int& amount);
+	void _get_path_table_size(FileTreeNode* node, unsigned int& size);
+
+private:
+	bool root; // Root directory of the disc, its records are laid out differently
+	DirectoryRecordsLayout* records_layout; // Built on first use, the tree must not change after that
 };
 
 class Directory
@@ -19,43 +19,41 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 #include "pch.h"
 #include "File.h"
 
-File::File(bool is_directory, long size, const char* path, const char* ext, const char* name) :
-	is_directory(is_directory), size(size), path(path), ext(ext), name(name)
+File::File(bool is_directory, unsigned long long size, const char* path, const char* ext, const char* name, long long modified_time) :
+	is_directory(is_directory), size(size), path(path), ext(ext), name(name), modified_time(modified_time)
 {}
 
-bool File::IsDirectory()
+bool File::IsDirectory() const
 {
 	return is_directory;
 }
 
-std::string File::GetPath()
+const std::string& File::GetPath() const
 {
 	return path;
 }
 
-std::string File::GetExt()
+const std::string& File::GetExt() const
 {
 	return ext;
 }
 
-std::string File::GetName()
+const std::string& File::GetName() const
 {
 	return name;
 }
 
-long File::GetSize()
+unsigned long long File::GetSize() const
 {
 	return size;
 }
 
-unsigned int File::GetSectorsSpace()
+unsigned int File::GetSectorsSpace() const
 {
-	auto aligned_size = 0;
-	if (size % 2048 != 0) {
-		aligned_size = size + (2048 - size % 2048); // Align the size to the sectors
-	}
-	else {
-		aligned_size = size;
-	}
-	return aligned_size / 2048;
+	return (size + 2047) / 2048; // Align the size to the sectors, SectorManager makes sure files fit in 32 bit sector numbers
+}
+
+long long File::GetModifiedTime() const
+{
+	return modified_time;
 }
@@ -21,19 +21,21 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 class File
 {
 public:
-	File(bool is_directory, long size, const char* path, const char* ext, const char* name);
-	bool IsDirectory();
-	std::string GetPath();
-	std::string GetExt();
-	std::string GetName();
-	long GetSize();
-	unsigned int GetSectorsSpace();
+	File(bool is_directory, unsigned long long size, const char* path, const char* ext, const char* name, long long modified_time = 0);
+	bool IsDirectory() const;
+	const std::string& GetPath() const;
+	const std::string& GetExt() const;
+	const std::string& GetName() const;
+	unsigned long long GetSize() const;
+	unsigned int GetSectorsSpace() const;
+	long long GetModifiedTime() const;
 
 private:
 	bool is_directory;
-	long size;
+	unsigned long long size;
 	std::string path;
 	std::string ext;
 	std::string name;
+	long long modified_time; // In the file system's own units, 0 when the source doesn't keep it
 };
 
@@ -0,0 +1,97 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "FileEntryTemplate.h"
+#include "Util.h"
+#include <cstring>
+
+FileEntryTemplate::FileEntryTemplate(const FileEntry& prototype) : base(prototype)
+{
+	auto& ea_tag = base.ext_attrib_hd.tag;
+	base.tag.tag_location = 0;
+	base.tag.tag_checksum = 0;
+	base.tag.desc_crc = 0;
+	base.file_link_cnt = 0;
+	base.info_len = 0;
+	base.log_blocks_rec = 0;
+	base.unique_id = 0;
+	base.alloc_desc.info_len = 0;
+	base.alloc_desc.log_block_num = 0;
+	ea_tag.tag_location = 0;
+	ea_tag.tag_checksum = 0;
+	base_crc = cksum((unsigned char*)&base + sizeof(DescriptorTag), base.tag.desc_crc_len);
+
+	auto ea_tag_offset = offsetof(FileEntry, ext_attrib_hd) + offsetof(EA_HeaderDescriptor, tag);
+	_add_field(ea_tag_offset + offsetof(DescriptorTag, tag_checksum), sizeof(byte));
+	_add_field(ea_tag_offset + offsetof(DescriptorTag, tag_location), sizeof(uint));
+	_add_field(offsetof(FileEntry, file_link_cnt), sizeof(ushort));
+	_add_field(offsetof(FileEntry, info_len), sizeof(ulong));
+	_add_field(offsetof(FileEntry, log_blocks_rec), sizeof(ulong));
+	_add_field(offsetof(FileEntry, unique_id), sizeof(ulong));
+	_add_field(offsetof(FileEntry, alloc_desc) + offsetof(AllocDescriptor, info_len), sizeof(uint));
+	_add_field(offsetof(FileEntry, alloc_desc) + offsetof(AllocDescriptor, log_block_num), sizeof(uint));
+}
+
+void FileEntryTemplate::fill(FileEntry& fe, uint location, ushort links, ulong info_len, ulong log_blocks, ulong unique_id, uint alloc_block)
+{
+	memcpy(&fe, &base, sizeof(FileEntry));
+	fe.file_link_cnt = links;
+	fe.info_len = info_len;
+	fe.log_blocks_rec = log_blocks;
+	fe.unique_id = unique_id;
+	fe.alloc_desc.info_len = info_len; // Size of file identifier descriptor for folders, size of file for files
+	fe.alloc_desc.log_block_num = alloc_block;
+	auto& ea_tag = fe.ext_attrib_hd.tag;
+	ea_tag.tag_location = location;
+	ea_tag.tag_checksum = cksum_tag((unsigned char*)&ea_tag, sizeof(DescriptorTag));
+	// Base CRC has all these bytes as 0, XOR in what each of them adds
+	auto bytes = (const unsigned char*)&fe;
+	auto crc = base_crc;
+	for (size_t i = 0; i < positions.size(); ++i) {
+		crc ^= crc_tables[i * 256 + bytes[positions[i]]];
+	}
+	fe.tag.desc_crc = crc;
+	fe.tag.tag_location = location;
+	fe.tag.tag_checksum = cksum_tag((unsigned char*)&fe.tag, sizeof(DescriptorTag));
+}
+
+// Every byte of the field gets a table of what it adds to the CRC for each of its values
+void FileEntryTemplate::_add_field(size_t offset, size_t size)
+{
+	auto crc_end = sizeof(DescriptorTag) + base.tag.desc_crc_len;
+	for (size_t pos = offset; pos < offset + size; ++pos) {
+		// CRC of a single set bit followed by zeros, the rest of the values are XORs of these
+		ushort bit_crcs[8];
+		for (int bit = 0; bit < 8; ++bit) {
+			ushort crc = crc_table[1 << bit];
+			for (size_t i = pos + 1; i < crc_end; ++i) {
+				crc = crc_table[(crc >> 8) & 0xff] ^ (crc << 8);
+			}
+			bit_crcs[bit] = crc;
+		}
+		positions.push_back(pos);
+		for (int value = 0; value < 256; ++value) {
+			ushort crc = 0;
+			for (int bit = 0; bit < 8; ++bit) {
+				if (value & (1 << bit)) crc ^= bit_crcs[bit];
+			}
+			crc_tables.push_back(crc);
+		}
+	}
+}
@@ -0,0 +1,41 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "SectorDescriptors.h"
+#include <vector>
+#include <stddef.h>
+
+// Prebuilt FileEntry where only the fields that differ between entries get patched in
+// Descriptor CRC is linear so instead of rehashing the whole entry each changed byte XORs in a precomputed value
+class FileEntryTemplate
+{
+public:
+	FileEntryTemplate(const FileEntry& prototype);
+
+	void fill(FileEntry& fe, uint location, ushort links, ulong info_len, ulong log_blocks, ulong unique_id, uint alloc_block);
+
+private:
+	void _add_field(size_t offset, size_t size);
+
+private:
+	FileEntry base; // Prototype with all the variable fields zeroed
+	ushort base_crc;
+	std::vector<size_t> positions; // Offsets of the variable bytes in the entry
+	std::vector<ushort> crc_tables; // 256 values for each variable byte, CRC of the entry when only that byte is set
+};
@@ -0,0 +1,409 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "ImageOutput.h"
+#include "SectorManager.h"
+#include "Checkpoint.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr auto NO_PART = 0xFFFFFFFFU;
+constexpr auto MAPPED_WINDOW_SIZE = 64 * 1024 * 1024ULL; // Written data is pushed to the disk and dropped from memory in windows this big
+
+FileOutput::FileOutput(const char* path, bool existing) : f(fopen(path, existing ? "rb+" : "wb+"))
+{
+	if (f == nullptr) {
+		throw ImageMakerException("Can't open the image");
+	}
+}
+
+FileOutput::~FileOutput()
+{
+	close();
+}
+
+void FileOutput::write(const void* data, size_t size)
+{
+	fwrite(data, 1, size, f);
+}
+
+void FileOutput::seek(unsigned long long offset)
+{
+	if (seek_image(f, offset) != 0) {
+		throw ImageMakerException("Can't seek to the requested sector");
+	}
+}
+
+unsigned long long FileOutput::tell()
+{
+#ifdef _WIN32
+	return _ftelli64(f);
+#else
+	return ftello(f);
+#endif
+}
+
+bool FileOutput::read(void* data, size_t size)
+{
+	return fread(data, 1, size, f) == size;
+}
+
+unsigned long long FileOutput::get_size()
+{
+	auto position = tell();
+	auto size = get_image_size(f);
+	seek_image(f, position);
+	return size;
+}
+
+void FileOutput::sync()
+{
+	sync_file(f);
+}
+
+FILE* FileOutput::get_file(unsigned long long& room)
+{
+	room = ~0ULL;
+	return f;
+}
+
+void FileOutput::close()
+{
+	if (f != nullptr) {
+		fclose(f);
+		f = nullptr;
+	}
+}
+
+#ifndef _WIN32
+// Space is reserved up front where the file system can, running out of it while writing to a mapping can't be handled
+MappedOutput::MappedOutput(const char* path, unsigned long long size, bool existing) : fd(-1), mapping(nullptr), size(size), file_size(0), position(0), flushed_windows(0)
+{
+	fd = open(path, O_RDWR | O_CREAT | (existing ? 0 : O_TRUNC), 0644);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) != 0) {
+		close();
+		throw ImageMakerException("Can't open the image");
+	}
+	file_size = st.st_size;
+	if (file_size < size && ftruncate(fd, size) != 0) {
+		close();
+		throw ImageMakerException("Can't resize the image");
+	}
+#ifdef __linux__
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0 && errno == ENOSPC) {
+		close();
+		throw ImageMakerException("Not enough space for the image");
+	}
+#endif
+	auto map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close();
+		throw ImageMakerException("Can't map the image");
+	}
+	mapping = (char*)map;
+}
+
+MappedOutput::~MappedOutput()
+{
+	close();
+}
+
+// Data that was put together in get_buffer's memory is already in place
+void MappedOutput::write(const void* data, size_t size)
+{
+	if (position + size > this->size) {
+		throw ImageMakerException("Can't write past the end of the mapped image");
+	}
+	if (data != mapping + position) {
+		memcpy(mapping + position, data, size);
+	}
+	position += size;
+	file_size = std::max(file_size, position);
+	_flush_windows();
+}
+
+void MappedOutput::seek(unsigned long long offset)
+{
+	position = offset;
+}
+
+unsigned long long MappedOutput::tell()
+{
+	return position;
+}
+
+bool MappedOutput::read(void* data, size_t size)
+{
+	if (position + size > this->size) {
+		return false;
+	}
+	memcpy(data, mapping + position, size);
+	position += size;
+	return true;
+}
+
+unsigned long long MappedOutput::get_size()
+{
+	return file_size;
+}
+
+void MappedOutput::sync()
+{
+	msync(mapping, size, MS_SYNC);
+	fsync(fd);
+}
+
+FILE* MappedOutput::get_file(unsigned long long& room)
+{
+	room = 0;
+	return nullptr;
+}
+
+char* MappedOutput::get_buffer(size_t size)
+{
+	return position + size <= this->size ? mapping + position : nullptr;
+}
+
+void MappedOutput::close()
+{
+	if (mapping != nullptr) {
+		munmap(mapping, size);
+		mapping = nullptr;
+	}
+	if (fd != -1) {
+		::close(fd);
+		fd = -1;
+	}
+}
+
+// Window before the one being written starts going to the disk, the one before that is waited for and dropped from memory
+// so no more than about two windows of the image are ever dirty in memory
+void MappedOutput::_flush_windows()
+{
+	auto window = position / MAPPED_WINDOW_SIZE;
+	if (flushed_windows + 1 >= window) {
+		return;
+	}
+#ifdef __linux__
+	sync_file_range(fd, (window - 1) * MAPPED_WINDOW_SIZE, MAPPED_WINDOW_SIZE, SYNC_FILE_RANGE_WRITE);
+#endif
+	for (; flushed_windows + 1 < window; ++flushed_windows) {
+		auto start = mapping + flushed_windows * MAPPED_WINDOW_SIZE;
+		msync(start, MAPPED_WINDOW_SIZE, MS_SYNC);
+		madvise(start, MAPPED_WINDOW_SIZE, MADV_DONTNEED);
+	}
+}
+#endif
+
+MemoryOutput::MemoryOutput() : position(0) {}
+
+void MemoryOutput::write(const void* data, size_t size)
+{
+	if (position + size > this->data.size()) {
+		this->data.resize(position + size);
+	}
+	memcpy(this->data.data() + position, data, size);
+	position += size;
+}
+
+void MemoryOutput::seek(unsigned long long offset)
+{
+	position = offset;
+}
+
+unsigned long long MemoryOutput::tell()
+{
+	return position;
+}
+
+bool MemoryOutput::read(void* data, size_t size)
+{
+	if (position + size > this->data.size()) {
+		return false;
+	}
+	memcpy(data, this->data.data() + position, size);
+	position += size;
+	return true;
+}
+
+unsigned long long MemoryOutput::get_size()
+{
+	return data.size();
+}
+
+void MemoryOutput::sync() {}
+
+FILE* MemoryOutput::get_file(unsigned long long& room)
+{
+	room = 0;
+	return nullptr;
+}
+
+void MemoryOutput::close() {}
+
+const std::vector<char>& MemoryOutput::get_data()
+{
+	return data;
+}
+
+// Parts that are already there are only picked up when continuing, a new image starts from part 0 and overwrites them
+SplitOutput::SplitOutput(const std::string& prefix, unsigned long long part_size, bool existing) : prefix(prefix), part_size(part_size), existing(existing), position(0), selected(NO_PART)
+{
+	while (existing) {
+		FILE* part = fopen(get_part_path(parts.size()).c_str(), "rb+");
+		if (part == nullptr) {
+			break;
+		}
+		parts.push_back(part);
+	}
+}
+
+SplitOutput::~SplitOutput()
+{
+	close();
+}
+
+// Writes that cross the end of a part go on at the start of the next one
+void SplitOutput::write(const void* data, size_t size)
+{
+	auto bytes = (const char*)data;
+	while (size > 0) {
+		auto part = _select_part();
+		auto write_size = (size_t)std::min<unsigned long long>(size, part_size - position % part_size);
+		fwrite(bytes, 1, write_size, part);
+		bytes += write_size;
+		size -= write_size;
+		position += write_size;
+	}
+}
+
+void SplitOutput::seek(unsigned long long offset)
+{
+	position = offset;
+	selected = NO_PART;
+}
+
+unsigned long long SplitOutput::tell()
+{
+	return position;
+}
+
+bool SplitOutput::read(void* data, size_t size)
+{
+	auto bytes = (char*)data;
+	while (size > 0) {
+		auto part = _select_part();
+		auto read_size = (size_t)std::min<unsigned long long>(size, part_size - position % part_size);
+		auto was_read = fread(bytes, 1, read_size, part);
+		position += was_read;
+		if (was_read != read_size) {
+			selected = NO_PART;
+			return false;
+		}
+		bytes += read_size;
+		size -= read_size;
+	}
+	return true;
+}
+
+// Every part but the last one is full so the size is where the last part ends
+unsigned long long SplitOutput::get_size()
+{
+	if (parts.empty()) {
+		return 0;
+	}
+	auto last = parts.size() - 1;
+	if (parts[last] == nullptr) {
+		return last * part_size;
+	}
+	selected = NO_PART;
+	return last * part_size + get_image_size(parts[last]);
+}
+
+void SplitOutput::sync()
+{
+	for (auto part : parts) {
+		if (part != nullptr) {
+			sync_file(part);
+		}
+	}
+}
+
+FILE* SplitOutput::get_file(unsigned long long& room)
+{
+	auto part = _select_part();
+	room = part_size - position % part_size;
+	return part;
+}
+
+void SplitOutput::close()
+{
+	for (auto& part : parts) {
+		if (part != nullptr) {
+			fclose(part);
+			part = nullptr;
+		}
+	}
+	selected = NO_PART;
+}
+
+unsigned int SplitOutput::get_parts_amount()
+{
+	return parts.size();
+}
+
+std::string SplitOutput::get_part_path(unsigned int part)
+{
+	char number[8];
+	snprintf(number, sizeof(number), "%02x", part);
+	return prefix + number;
+}
+
+FILE* SplitOutput::_select_part()
+{
+	auto part = (unsigned int)(position / part_size);
+	if (part >= parts.size()) {
+		parts.resize(part + 1, nullptr);
+	}
+	if (parts[part] == nullptr) {
+		auto path = get_part_path(part);
+		parts[part] = fopen(path.c_str(), existing ? "rb+" : "wb+");
+		if (parts[part] == nullptr && existing) {
+			parts[part] = fopen(path.c_str(), "wb+");
+		}
+		if (parts[part] == nullptr) {
+			throw ImageMakerException("Can't create a part of the image");
+		}
+	}
+	if (selected != part) {
+		if (seek_image(parts[part], position % part_size) != 0) {
+			throw ImageMakerException("Can't seek to the requested sector");
+		}
+		selected = part;
+	}
+	return parts[part];
+}
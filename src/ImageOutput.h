@@ -0,0 +1,143 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+// Where the pack puts the image, it's written front to back as a single stream of sectors with only a few seeks
+class ImageOutput
+{
+public:
+	virtual ~ImageOutput() {}
+
+	virtual void write(const void* data, size_t size) = 0;
+	virtual void seek(unsigned long long offset) = 0;
+	virtual unsigned long long tell() = 0;
+	virtual bool read(void* data, size_t size) = 0;
+	virtual unsigned long long get_size() = 0;
+	virtual void sync() = 0; // Everything written so far has to reach the storage and not just the OS cache
+	// File the next bytes go to positioned where they go, room is how many bytes it takes until the output moves on to another file
+	virtual FILE* get_file(unsigned long long& room) = 0;
+	// Memory the next size bytes can be put together in before they are written, nullptr unless the image is mapped
+	virtual char* get_buffer(size_t /*size*/) { return nullptr; }
+	virtual void close() = 0;
+};
+
+// Whole image in a single file
+class FileOutput : public ImageOutput
+{
+public:
+	FileOutput(const char* path, bool existing); // Existing images are opened to be continued instead of being created anew
+	~FileOutput();
+
+	void write(const void* data, size_t size) override;
+	void seek(unsigned long long offset) override;
+	unsigned long long tell() override;
+	bool read(void* data, size_t size) override;
+	unsigned long long get_size() override;
+	void sync() override;
+	FILE* get_file(unsigned long long& room) override;
+	void close() override;
+
+private:
+	FILE* f;
+};
+
+#ifndef _WIN32
+// Whole image mapped into memory, descriptors and file data are put together right where they go and writing them only moves on
+class MappedOutput : public ImageOutput
+{
+public:
+	MappedOutput(const char* path, unsigned long long size, bool existing);
+	~MappedOutput();
+
+	void write(const void* data, size_t size) override;
+	void seek(unsigned long long offset) override;
+	unsigned long long tell() override;
+	bool read(void* data, size_t size) override;
+	unsigned long long get_size() override;
+	void sync() override;
+	FILE* get_file(unsigned long long& room) override; // Always nullptr with no room, data is read straight into the mapping instead
+	char* get_buffer(size_t size) override;
+	void close() override;
+
+private:
+	void _flush_windows();
+
+private:
+	int fd;
+	char* mapping;
+	unsigned long long size;
+	unsigned long long file_size; // Before it was mapped, grows with what's written
+	unsigned long long position;
+	unsigned long long flushed_windows; // Windows written back and dropped from memory
+};
+#endif
+
+// Image kept in memory, e.g. the metadata of a virtual image. It isn't a file so nothing can be copied into it by the kernel
+class MemoryOutput : public ImageOutput
+{
+public:
+	MemoryOutput();
+
+	void write(const void* data, size_t size) override;
+	void seek(unsigned long long offset) override;
+	unsigned long long tell() override;
+	bool read(void* data, size_t size) override;
+	unsigned long long get_size() override;
+	void sync() override;
+	FILE* get_file(unsigned long long& room) override; // Always nullptr with no room
+	void close() override;
+	const std::vector<char>& get_data();
+
+private:
+	std::vector<char> data;
+	unsigned long long position;
+};
+
+// Image cut into parts of the same size named prefix + part number in 2 hex digits, a part is created once the first byte goes into it
+class SplitOutput : public ImageOutput
+{
+public:
+	SplitOutput(const std::string& prefix, unsigned long long part_size, bool existing);
+	~SplitOutput();
+
+	void write(const void* data, size_t size) override;
+	void seek(unsigned long long offset) override;
+	unsigned long long tell() override;
+	bool read(void* data, size_t size) override;
+	unsigned long long get_size() override;
+	void sync() override;
+	FILE* get_file(unsigned long long& room) override;
+	void close() override;
+	unsigned int get_parts_amount();
+	std::string get_part_path(unsigned int part);
+
+private:
+	FILE* _select_part(); // Part that holds the current position, seeked to it
+
+private:
+	std::string prefix;
+	unsigned long long part_size;
+	bool existing;
+	std::vector<FILE*> parts; // nullptr for parts that weren't opened yet
+	unsigned long long position;
+	unsigned int selected; // Part whose file position matches the current position, NO_PART if none does
+};
@@ -0,0 +1,443 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "ImageReader.h"
+#include "SectorManager.h"
+#include "SectorDescriptors.h"
+#include "Util.h"
+#include <cstring>
+#include <cstdarg>
+#include <cstddef>
+#include <stdio.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+constexpr auto MAX_KEPT_ERRORS = 64U;
+constexpr auto MAX_TREE_DEPTH = 64; // Anything deeper is most likely a directory pointing back at its parent
+constexpr auto ISO_ROOT_RECORD_OFFSET = 156U; // Where the root directory record is in ISO's primary volume descriptor
+
+ImageReader::ImageReader(const char* path) : data(nullptr), size(0), partition_start_sector(0), descriptors_checked(0), errors_amount(0)
+{
+#ifdef _WIN32
+	file_handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		throw ImageMakerException("Can't open the image");
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle, &file_size);
+	size = file_size.QuadPart;
+	mapping_handle = size == 0 ? NULL : CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_handle == NULL) {
+		CloseHandle(file_handle);
+		throw ImageMakerException("Can't map the image into memory");
+	}
+	data = (const unsigned char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping_handle);
+		CloseHandle(file_handle);
+		throw ImageMakerException("Can't map the image into memory");
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		throw ImageMakerException("Can't open the image");
+	}
+	struct stat sb;
+	fstat(fd, &sb);
+	size = sb.st_size;
+	void* mapping = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // Mapping keeps its own reference
+	if (mapping == MAP_FAILED) {
+		throw ImageMakerException("Can't map the image into memory");
+	}
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	data = (const unsigned char*)mapping;
+#endif
+}
+
+ImageReader::~ImageReader()
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mapping_handle);
+	CloseHandle(file_handle);
+#else
+	munmap((void*)data, size);
+#endif
+}
+
+// Goes through everything outside of the partition's trees, has to be called before reading the trees
+bool ImageReader::read_volume_descriptors()
+{
+	if (size % 2048 != 0 || size < 262 * 2048ULL) {
+		add_error("Image size %llu isn't a whole amount of sectors or is too small to be an image", size);
+		return false;
+	}
+	auto total_sectors = get_total_sectors();
+	// ISO side
+	auto pvd = (const PrimaryVolumeDescriptor_ISO*)get_sector(16);
+	if (pvd->type != 1 || strncmp(pvd->ident, "CD001", 5) != 0) {
+		add_error("Sector 16 isn't an ISO primary volume descriptor");
+		return false;
+	}
+	if (pvd->vol_space_size_lsb != total_sectors || changeEndianness32(pvd->vol_space_size_msb) != total_sectors) {
+		add_error("ISO volume space size is %u sectors but the image has %u", pvd->vol_space_size_lsb, total_sectors);
+	}
+	auto terminator = (const VolumeDescriptorSetTerminator*)get_sector(17);
+	if (terminator->type != 0xFF || strncmp(terminator->identifier, "CD001", 5) != 0) {
+		add_error("Sector 17 isn't an ISO volume descriptor set terminator");
+	}
+	const char* extended_area[3] = { "BEA01", "NSR02", "TEA01" };
+	for (int i = 0; i < 3; ++i) {
+		if (strncmp((const char*)get_sector(18 + i) + 1, extended_area[i], 5) != 0) {
+			add_error("Sector %d isn't %s", 18 + i, extended_area[i]);
+		}
+	}
+	// UDF side, everything is found through the anchor
+	auto avd = (const AnchorVolumeDescriptorPointer*)get_sector(256);
+	if (!_check_tag(get_sector(256), 2, 256, "Anchor volume descriptor pointer")) {
+		return false;
+	}
+	auto main_ok = _read_volume_descriptor_sequence(avd->main_vol_desc_seq_extent.location, "Main volume descriptor sequence");
+	auto reserve_ok = _read_volume_descriptor_sequence(avd->reserve_vol_desc_seq_extent.location, "Reserve volume descriptor sequence");
+	if (!main_ok && !reserve_ok) {
+		return false;
+	}
+	_check_tag(get_sector(64), 9, 64, "Logical volume integrity descriptor");
+	_check_tag(get_sector(65), 8, 65, "Integrity sequence terminator");
+	_check_tag(get_sector(total_sectors - 1), 2, total_sectors - 1, "End of session descriptor");
+	if (partition_start_sector == 0 || partition_start_sector + 2 >= total_sectors) {
+		add_error("Partition starts at sector %u which is outside of the image", partition_start_sector);
+		return false;
+	}
+	return _check_tag(get_sector(partition_start_sector), 0x100, 0, "File set descriptor");
+}
+
+// UDF tree is what the console actually reads, paths keep their original case
+std::vector<ImageEntry> ImageReader::read_udf_tree()
+{
+	std::vector<ImageEntry> entries;
+	auto fsd = (const FileSetDescriptor*)get_sector(partition_start_sector);
+	if (fsd == nullptr) {
+		return entries;
+	}
+	_read_udf_directory(fsd->root_dir_icb.extent_loc.log_block_num, "", entries, 0);
+	return entries;
+}
+
+// ISO tree is there for everything else, names are in upper case and files lose their ;1
+std::vector<ImageEntry> ImageReader::read_iso_tree()
+{
+	std::vector<ImageEntry> entries;
+	auto root = (const DirectoryRecord*)(get_sector(16) + ISO_ROOT_RECORD_OFFSET);
+	_read_iso_directory(root->loc_of_ext_lsb, root->data_len_lsb, "", entries, 0);
+	return entries;
+}
+
+// Checks that all path table copies agree with each other, returns the sector of every directory listed
+std::vector<unsigned int> ImageReader::read_path_table()
+{
+	std::vector<unsigned int> sectors;
+	auto pvd = (const PrimaryVolumeDescriptor_ISO*)get_sector(16);
+	unsigned int table_size = pvd->path_table_size_lsb;
+	unsigned int locations[4] = { (unsigned int)pvd->loc_type_l_path_tbl, (unsigned int)pvd->loc_opt_l_path_tbl,
+		changeEndianness32(pvd->loc_type_m_path_tbl), changeEndianness32(pvd->loc_opt_m_path_tbl) };
+	for (auto location : locations) {
+		if (location != 0 && ((unsigned long long)location * 2048 + table_size > size)) {
+			add_error("Path table at sector %u doesn't fit in the image", location);
+			return sectors;
+		}
+	}
+	auto table_l = get_sector(locations[0]);
+	auto table_m = get_sector(locations[2]);
+	if (locations[1] != 0 && memcmp(table_l, get_sector(locations[1]), table_size) != 0) {
+		add_error("Optional path table L differs from path table L");
+	}
+	if (locations[3] != 0 && memcmp(table_m, get_sector(locations[3]), table_size) != 0) {
+		add_error("Optional path table M differs from path table M");
+	}
+	unsigned int offset = 0;
+	while (offset + 8 <= table_size) {
+		auto ident_len = table_l[offset];
+		if (ident_len == 0) {
+			break;
+		}
+		auto entry_size = 8U + ident_len + ident_len % 2;
+		unsigned int lba, lba_m;
+		unsigned short parent, parent_m;
+		memcpy(&lba, table_l + offset + 2, 4);
+		memcpy(&lba_m, table_m + offset + 2, 4);
+		memcpy(&parent, table_l + offset + 6, 2);
+		memcpy(&parent_m, table_m + offset + 6, 2);
+		if (table_m[offset] != ident_len || changeEndianness32(lba_m) != lba || changeEndianness16(parent_m) != parent ||
+			offset + entry_size > table_size || memcmp(table_l + offset + 8, table_m + offset + 8, ident_len) != 0) {
+			add_error("Path table M doesn't match path table L at byte %u", offset);
+			break;
+		}
+		sectors.push_back(lba);
+		offset += entry_size;
+	}
+	return sectors;
+}
+
+const unsigned char* ImageReader::get_sector(unsigned int sector)
+{
+	if ((unsigned long long)sector * 2048 >= size) {
+		return nullptr;
+	}
+	return data + (unsigned long long)sector * 2048;
+}
+
+unsigned long long ImageReader::get_size()
+{
+	return size;
+}
+
+unsigned int ImageReader::get_total_sectors()
+{
+	return size / 2048;
+}
+
+unsigned int ImageReader::get_partition_start_sector()
+{
+	return partition_start_sector;
+}
+
+// Root directory moves further when the path tables take more than a sector each
+unsigned int ImageReader::get_iso_root_sector()
+{
+	auto root = (const DirectoryRecord*)(get_sector(16) + ISO_ROOT_RECORD_OFFSET);
+	return root->loc_of_ext_lsb;
+}
+
+unsigned int ImageReader::get_descriptors_checked()
+{
+	return descriptors_checked;
+}
+
+unsigned int ImageReader::get_errors_amount()
+{
+	return errors_amount;
+}
+
+const std::vector<std::string>& ImageReader::get_errors()
+{
+	return errors;
+}
+
+void ImageReader::add_error(const char* format, ...)
+{
+	char message[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	std::lock_guard<std::mutex> guard(errors_mut);
+	errors_amount++;
+	if (errors.size() < MAX_KEPT_ERRORS) {
+		errors.push_back(message);
+	}
+}
+
+// Same checks a UDF reader does before trusting a descriptor
+bool ImageReader::_check_tag(const unsigned char* desc, unsigned short ident, unsigned int location, const char* what)
+{
+	descriptors_checked++;
+	if (desc == nullptr) {
+		add_error("%s at %u is outside of the image", what, location);
+		return false;
+	}
+	DescriptorTag tag;
+	memcpy(&tag, desc, sizeof(DescriptorTag));
+	if (tag.tag_ident != ident) {
+		add_error("%s at %u has tag identifier 0x%X instead of 0x%X", what, location, tag.tag_ident, ident);
+		return false;
+	}
+	if (tag.tag_checksum != cksum_tag((unsigned char*)desc, sizeof(DescriptorTag))) {
+		add_error("%s at %u has a wrong tag checksum", what, location);
+		return false;
+	}
+	if (tag.tag_location != location) {
+		add_error("%s at %u says it's at %u", what, location, tag.tag_location);
+		return false;
+	}
+	if (desc + sizeof(DescriptorTag) + tag.desc_crc_len > data + size) {
+		add_error("%s at %u goes past the end of the image", what, location);
+		return false;
+	}
+	if (tag.desc_crc != cksum((unsigned char*)desc + sizeof(DescriptorTag), tag.desc_crc_len)) {
+		add_error("%s at %u has a wrong CRC", what, location);
+		return false;
+	}
+	return true;
+}
+
+bool ImageReader::_read_volume_descriptor_sequence(unsigned int sector, const char* what)
+{
+	// Sequence extent is 16 sectors long, it ends with a terminating descriptor
+	for (unsigned int i = sector; i < sector + 16; ++i) {
+		auto desc = get_sector(i);
+		if (desc == nullptr) {
+			break;
+		}
+		unsigned short ident;
+		memcpy(&ident, desc, sizeof(ident));
+		if (!_check_tag(desc, ident, i, what)) {
+			return false;
+		}
+		if (ident == 5) {
+			auto pd = (const PartitionDescriptor*)desc;
+			partition_start_sector = pd->part_start_loc;
+			if (pd->part_start_loc + pd->part_len + 1 != get_total_sectors()) {
+				add_error("Partition of %u sectors from %u doesn't end right before the last sector", pd->part_len, pd->part_start_loc);
+			}
+		}
+		if (ident == 8) {
+			return true;
+		}
+	}
+	add_error("%s at %u has no terminating descriptor", what, sector);
+	return false;
+}
+
+void ImageReader::_read_udf_directory(unsigned int fe_lba, const std::string& path, std::vector<ImageEntry>& entries, int depth)
+{
+	if (depth > MAX_TREE_DEPTH) {
+		add_error("UDF directory %s is nested too deep", path.c_str());
+		return;
+	}
+	auto fe_data = get_sector(partition_start_sector + fe_lba);
+	if (!_check_tag(fe_data, 0x105, fe_lba, "Directory file entry")) {
+		return;
+	}
+	auto fe = (const FileEntry*)fe_data;
+	auto ad = (const AllocDescriptor*)(fe_data + offsetof(FileEntry, ext_attrib_hd) + fe->len_of_ext_attrib);
+	auto fids = get_sector(partition_start_sector + ad->log_block_num);
+	if (fids == nullptr || fids + ad->info_len > data + size) {
+		add_error("File identifiers of UDF directory %s are outside of the image", path.c_str());
+		return;
+	}
+	unsigned int offset = 0;
+	while (offset + sizeof(FileIdentifierDescriptor) <= ad->info_len) {
+		auto fid_data = fids + offset;
+		auto fid_lba = ad->log_block_num + offset / 2048;
+		if (!_check_tag(fid_data, 0x101, fid_lba, "File identifier descriptor")) {
+			return;
+		}
+		auto fid = (const FileIdentifierDescriptor*)fid_data;
+		offset += (38 + fid->len_of_file_ident + fid->len_of_impl_use + 3) & ~3;
+		if (fid->file_chars & 0x8) { // Parent directory
+			continue;
+		}
+		unicode_t name_chars[256];
+		auto name_len = UncompressUnicode(fid->len_of_file_ident, (byte*)fid_data + 38 + fid->len_of_impl_use, name_chars);
+		if (name_len <= 0) {
+			add_error("File identifier at %u in UDF directory %s has an invalid name", fid_lba, path.c_str());
+			continue;
+		}
+		ImageEntry entry;
+		entry.path = path;
+		for (int i = 0; i < name_len; ++i) {
+			entry.path.push_back(name_chars[i] < 0x100 ? (char)name_chars[i] : '?');
+		}
+		entry.is_directory = (fid->file_chars & 0x2) != 0;
+		auto child_lba = fid->icb.extent_loc.log_block_num;
+		auto child_data = get_sector(partition_start_sector + child_lba);
+		if (!_check_tag(child_data, 0x105, child_lba, entry.is_directory ? "Directory file entry" : "File entry")) {
+			continue;
+		}
+		auto child = (const FileEntry*)child_data;
+		_check_tag(child_data + offsetof(FileEntry, ext_attrib_hd), 0x106, child_lba, "Extended attribute header");
+		if (child->icb_tag.file_type != (entry.is_directory ? 4 : 5)) {
+			add_error("File entry of %s has file type %d", entry.path.c_str(), child->icb_tag.file_type);
+		}
+		// Big files take several extents, everything else expects the data to be in one piece so they must follow each other
+		auto child_ad = (const AllocDescriptor*)(child_data + offsetof(FileEntry, ext_attrib_hd) + child->len_of_ext_attrib);
+		auto ads_amount = child->len_of_alloc_desc / sizeof(AllocDescriptor);
+		if (ads_amount == 0 || (const unsigned char*)(child_ad + ads_amount) > child_data + 2048) {
+			add_error("File entry of %s has %u bytes of allocation descriptors", entry.path.c_str(), child->len_of_alloc_desc);
+			continue;
+		}
+		unsigned long long extents_size = 0;
+		for (unsigned int i = 0; i < ads_amount; ++i) {
+			auto length = child_ad[i].info_len & 0x3FFFFFFF; // Top bits are the extent's type
+			if (i + 1 < ads_amount && (length % 2048 != 0 || child_ad[i + 1].log_block_num != child_ad[i].log_block_num + length / 2048)) {
+				add_error("Extent %u of %s isn't followed by the next one", i, entry.path.c_str());
+			}
+			extents_size += length;
+		}
+		if (extents_size != child->info_len) {
+			add_error("File entry of %s records %llu bytes but its extents have %llu", entry.path.c_str(), (unsigned long long)child->info_len, extents_size);
+		}
+		entry.sector = partition_start_sector + child_ad->log_block_num;
+		entry.size = child->info_len;
+		entries.push_back(entry);
+		if (entry.is_directory) {
+			_read_udf_directory(child_lba, entry.path + "/", entries, depth + 1);
+		}
+	}
+}
+
+void ImageReader::_read_iso_directory(unsigned int sector, unsigned int dir_size, const std::string& path, std::vector<ImageEntry>& entries, int depth)
+{
+	if (depth > MAX_TREE_DEPTH) {
+		add_error("ISO directory %s is nested too deep", path.c_str());
+		return;
+	}
+	auto records = get_sector(sector);
+	if (records == nullptr || records + dir_size > data + size) {
+		add_error("Records of ISO directory %s are outside of the image", path.c_str());
+		return;
+	}
+	unsigned int offset = 0;
+	while (offset < dir_size) {
+		auto rec_len = records[offset];
+		if (rec_len == 0) { // Records never cross sectors, rest of the sector is padding
+			offset = (offset / 2048 + 1) * 2048;
+			continue;
+		}
+		auto rec = (const DirectoryRecord*)(records + offset);
+		offset += rec_len;
+		if (rec->file_ident_len == 1 && (rec->file_ident == 0 || rec->file_ident == 1)) { // Navigation records
+			continue;
+		}
+		if (changeEndianness32(rec->loc_of_ext_msb) != (unsigned int)rec->loc_of_ext_lsb ||
+			changeEndianness32(rec->data_len_msb) != (unsigned int)rec->data_len_lsb) {
+			add_error("Directory record at byte %u of ISO directory %s has mismatching byte orders", offset - rec_len, path.c_str());
+		}
+		ImageEntry entry;
+		entry.is_directory = (rec->flags & 0x2) != 0;
+		std::string name(&rec->file_ident, rec->file_ident_len);
+		auto version = name.find(';');
+		if (!entry.is_directory && version != std::string::npos) {
+			name.resize(version);
+		}
+		entry.path = path + name;
+		entry.sector = rec->loc_of_ext_lsb;
+		entry.size = (unsigned int)rec->data_len_lsb;
+		entries.push_back(entry);
+		if (entry.is_directory) {
+			_read_iso_directory(entry.sector, entry.size, entry.path + "/", entries, depth + 1);
+		}
+	}
+}
@@ -0,0 +1,72 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+// A file or a directory found in one of the image's trees
+struct ImageEntry {
+	std::string path; // Relative to the root, separated with /
+	bool is_directory;
+	unsigned int sector; // Global sector of the file's data or of the directory's records
+	unsigned long long size;
+};
+
+// Maps an already built image into memory and parses it back, every descriptor it goes through gets its tag checked
+class ImageReader
+{
+public:
+	ImageReader(const char* path);
+	~ImageReader();
+
+	bool read_volume_descriptors();
+	std::vector<ImageEntry> read_udf_tree();
+	std::vector<ImageEntry> read_iso_tree();
+	std::vector<unsigned int> read_path_table();
+	const unsigned char* get_sector(unsigned int sector);
+	unsigned long long get_size();
+	unsigned int get_total_sectors();
+	unsigned int get_partition_start_sector();
+	unsigned int get_iso_root_sector();
+	unsigned int get_descriptors_checked();
+	unsigned int get_errors_amount();
+	const std::vector<std::string>& get_errors();
+	void add_error(const char* format, ...);
+
+private:
+	bool _check_tag(const unsigned char* data, unsigned short ident, unsigned int location, const char* what);
+	bool _read_volume_descriptor_sequence(unsigned int sector, const char* what);
+	void _read_udf_directory(unsigned int fe_lba, const std::string& path, std::vector<ImageEntry>& entries, int depth);
+	void _read_iso_directory(unsigned int sector, unsigned int size, const std::string& path, std::vector<ImageEntry>& entries, int depth);
+
+private:
+	const unsigned char* data;
+	unsigned long long size;
+	unsigned int partition_start_sector;
+	unsigned int descriptors_checked;
+	unsigned int errors_amount;
+	std::vector<std::string> errors; // Only the first few messages are kept, errors_amount has the actual count
+	std::mutex errors_mut;
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+};
@@ -0,0 +1,97 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "ImageSource.h"
+#include "ImageReader.h"
+#include "SectorManager.h"
+#include "Directory.h"
+#include "File.h"
+#include "Checkpoint.h"
+#include <cstring>
+
+ImageSource::ImageSource(const char* path) : path(path) {}
+
+FileTree* ImageSource::get_files()
+{
+	offsets.clear();
+	std::vector<ImageEntry> entries;
+	unsigned long long image_size = 0;
+	try {
+		ImageReader reader(path.c_str());
+		if (!reader.read_volume_descriptors()) {
+			return nullptr;
+		}
+		// Images from other tools can have descriptors this library wouldn't write, only the tree itself has to be sound
+		auto descriptor_errors = reader.get_errors_amount();
+		entries = reader.read_udf_tree();
+		if (reader.get_errors_amount() != descriptor_errors) {
+			return nullptr;
+		}
+		image_size = reader.get_size();
+	}
+	catch (const ImageMakerException&) {
+		return nullptr;
+	}
+	FileTreeBuilder builder;
+	for (auto& entry : entries) {
+		auto offset = (unsigned long long)entry.sector * 2048;
+		if (!entry.is_directory && offset + entry.size > image_size) {
+			offsets.clear();
+			return nullptr;
+		}
+		auto file = builder.add(entry.path, entry.is_directory, entry.size);
+		if (file == nullptr) {
+			offsets.clear();
+			return nullptr;
+		}
+		if (!entry.is_directory) {
+			offsets[file] = offset;
+		}
+	}
+	return builder.release();
+}
+
+InputStream* ImageSource::open(File* file)
+{
+	auto offset = offsets.find(file);
+	if (offset == offsets.end()) {
+		return nullptr;
+	}
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == nullptr) {
+		return nullptr;
+	}
+	if (seek_image(f, offset->second) != 0) {
+		fclose(f);
+		return nullptr;
+	}
+	return new FileStream(f, offset->second, file->GetSize());
+}
+
+bool is_disc_image(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == nullptr) {
+		return false;
+	}
+	char ident[6] = {};
+	auto is_image = seek_image(f, 16 * 2048) == 0 && fread(ident, 1, sizeof(ident), f) == sizeof(ident) && memcmp(ident, "\x01" "CD001", 6) == 0;
+	fclose(f);
+	return is_image;
+}
@@ -0,0 +1,37 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "InputSource.h"
+
+// Files of an already built image, the tree is read from its UDF side and the data is read from where the file is in the image
+class ImageSource : public InputSource
+{
+public:
+	ImageSource(const char* path);
+
+	FileTree* get_files() override;
+	InputStream* open(File* file) override;
+
+private:
+	std::string path;
+	std::map<File*, unsigned long long> offsets; // Byte offset of every file's data in the image
+};
+
+// Image files start with 16 empty sectors followed by the ISO primary volume descriptor
+bool is_disc_image(const char* path);
@@ -0,0 +1,227 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "ImageVerifier.h"
+#include "SectorManager.h"
+#include "Directory.h"
+#include "InputSource.h"
+#include "File.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <stdio.h>
+
+constexpr auto VERIFY_CHUNK_SIZE = 8 * 1024 * 1024U; // Big enough for the disk to read ahead, small enough to keep every worker busy on big files
+
+void _collect_source_files(FileTree* ft, const std::string& path, std::map<std::string, File*>& sources);
+
+ImageVerifier::ImageVerifier(ImageReader& reader) : reader(reader), source(nullptr), next_chunk(0), bytes_compared(0), directories_checked(0) {}
+
+// Both trees have to describe the same files at the same place and nothing can overlap
+void ImageVerifier::verify_structure()
+{
+	if (!reader.read_volume_descriptors()) {
+		return;
+	}
+	auto udf = reader.read_udf_tree();
+	auto iso = reader.read_iso_tree();
+	auto path_table = reader.read_path_table();
+
+	std::map<std::string, ImageEntry*> iso_entries;
+	std::set<unsigned int> iso_directories;
+	iso_directories.insert(reader.get_iso_root_sector());
+	for (auto& entry : iso) {
+		iso_entries.emplace(entry.path, &entry);
+		if (entry.is_directory) {
+			iso_directories.insert(entry.sector);
+		}
+	}
+	for (auto& entry : udf) {
+		auto iso_entry = iso_entries.find(normalize_disc_path(entry.path));
+		if (iso_entry == iso_entries.end()) {
+			reader.add_error("%s is only in the UDF tree", entry.path.c_str());
+			continue;
+		}
+		auto& other = *iso_entry->second;
+		iso_entries.erase(iso_entry);
+		if (entry.is_directory != other.is_directory) {
+			reader.add_error("%s is a directory only in one of the trees", entry.path.c_str());
+			continue;
+		}
+		if (entry.is_directory) {
+			directories_checked++;
+			continue;
+		}
+		if (entry.sector != other.sector || entry.size != other.size) {
+			reader.add_error("%s is at %u with %llu bytes in UDF but at %u with %llu bytes in ISO", entry.path.c_str(), entry.sector, entry.size, other.sector, other.size);
+		}
+		files.push_back(entry);
+	}
+	for (auto& entry : iso_entries) {
+		reader.add_error("%s is only in the ISO tree", entry.second->path.c_str());
+	}
+	for (auto sector : path_table) {
+		if (iso_directories.find(sector) == iso_directories.end()) {
+			reader.add_error("Path table points at sector %u which doesn't hold a directory", sector);
+		}
+	}
+
+	// Everything has to be between the partition's metadata and the end of session descriptor
+	// Empty files take no sectors and share theirs with the next file, they go first so they don't look like an overlap
+	std::sort(files.begin(), files.end(), [](const ImageEntry& f1, const ImageEntry& f2) {
+		if (f1.sector != f2.sector) {
+			return f1.sector < f2.sector;
+		}
+		return f1.size < f2.size;
+	});
+	auto data_end = reader.get_total_sectors() - 1;
+	for (size_t i = 0; i < files.size(); ++i) {
+		auto& file = files[i];
+		auto end = file.sector + (file.size + 2047) / 2048;
+		if (file.sector <= reader.get_partition_start_sector() || end > data_end) {
+			reader.add_error("%s at %u is outside of the data area", file.path.c_str(), file.sector);
+		}
+		if (i + 1 < files.size() && end > files[i + 1].sector) {
+			reader.add_error("%s overlaps %s", file.path.c_str(), files[i + 1].path.c_str());
+		}
+	}
+}
+
+// Every file's data has to match its source byte for byte, files are split into chunks and compared on all cores
+void ImageVerifier::verify_contents(const char* game_path)
+{
+	std::unique_ptr<InputSource> input(open_input_source(game_path));
+	FileTree* ft = input->get_files();
+	if (ft == nullptr) {
+		reader.add_error("Can't read source %s", game_path);
+		return;
+	}
+	source = input.get();
+	std::map<std::string, File*> source_files;
+	_collect_source_files(ft, "", source_files);
+	for (size_t i = 0; i < files.size(); ++i) {
+		auto& file = files[i];
+		auto source = source_files.find(normalize_disc_path(file.path));
+		if (source == source_files.end()) {
+			reader.add_error("%s isn't in the source", file.path.c_str());
+			sources.push_back(nullptr);
+			continue;
+		}
+		sources.push_back(source->second);
+		if (source->second->GetSize() != file.size) {
+			reader.add_error("%s has %llu bytes but its source has %llu", file.path.c_str(), file.size, source->second->GetSize());
+		}
+		// Files of a cut off image that end past it were already reported by the structure check, there's nothing of them to compare
+		else if (file.sector + (file.size + 2047) / 2048 <= reader.get_total_sectors()) {
+			for (unsigned long long offset = 0; offset < file.size; offset += VERIFY_CHUNK_SIZE) {
+				VerifyChunk chunk;
+				chunk.file = i;
+				chunk.offset = offset;
+				chunk.length = std::min<unsigned long long>(VERIFY_CHUNK_SIZE, file.size - offset);
+				chunk.last = offset + chunk.length == file.size;
+				chunks.push_back(chunk);
+			}
+		}
+		source_files.erase(source);
+	}
+	for (auto& source : source_files) {
+		reader.add_error("%s is missing from the image", source.first.c_str());
+	}
+
+	auto threads_amount = std::max(1U, std::min<unsigned int>(std::thread::hardware_concurrency(), chunks.size()));
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < threads_amount; ++i) {
+		workers.push_back(std::thread(&ImageVerifier::_compare_chunks, this));
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	source = nullptr;
+	sources.clear();
+	delete ft;
+}
+
+unsigned int ImageVerifier::get_directories_checked()
+{
+	return directories_checked;
+}
+
+unsigned int ImageVerifier::get_files_checked()
+{
+	return files.size();
+}
+
+unsigned long long ImageVerifier::get_bytes_compared()
+{
+	return bytes_compared;
+}
+
+// Chunks are handed out in image order so the image is still read mostly front to back
+void ImageVerifier::_compare_chunks()
+{
+	std::vector<char> buffer(VERIFY_CHUNK_SIZE);
+	std::unique_ptr<InputStream> in;
+	size_t open_file = files.size();
+	for (auto i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+		auto& chunk = chunks[i];
+		auto& file = files[chunk.file];
+		if (chunk.file != open_file) {
+			in.reset(source->open(sources[chunk.file]));
+			open_file = chunk.file;
+		}
+		if (in == nullptr) {
+			reader.add_error("Can't open source of %s", file.path.c_str());
+			continue;
+		}
+		if (!in->seek(chunk.offset) || in->read(buffer.data(), chunk.length) != chunk.length) {
+			reader.add_error("Can't read source of %s", file.path.c_str());
+			continue;
+		}
+		auto image_data = reader.get_sector(file.sector) + chunk.offset;
+		if (memcmp(image_data, buffer.data(), chunk.length) != 0) {
+			auto mismatch = std::mismatch(buffer.begin(), buffer.begin() + chunk.length, (const char*)image_data);
+			reader.add_error("%s differs from its source at byte %llu", file.path.c_str(), chunk.offset + (mismatch.first - buffer.begin()));
+		}
+		// Rest of the file's last sector must be left empty, only files that end inside the image get chunks so the sector is there
+		if (chunk.last) {
+			auto tail = image_data + chunk.length;
+			auto tail_end = reader.get_sector(file.sector) + (file.size + 2047) / 2048 * 2048;
+			if (std::find_if(tail, tail_end, [](unsigned char c) { return c != 0; }) != tail_end) {
+				reader.add_error("%s has garbage after its end", file.path.c_str());
+			}
+		}
+		bytes_compared += chunk.length;
+	}
+}
+
+void _collect_source_files(FileTree* ft, const std::string& path, std::map<std::string, File*>& sources)
+{
+	for (auto node : ft->tree) {
+		auto node_path = path + node->file->GetName();
+		if (node->file->IsDirectory()) {
+			_collect_source_files(node->next, node_path + "/", sources);
+		}
+		else {
+			sources.emplace(normalize_disc_path(node_path), node->file);
+		}
+	}
+}
@@ -0,0 +1,58 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "ImageReader.h"
+#include <atomic>
+
+class File;
+class InputSource;
+
+// Part of a file that is compared by a single worker
+struct VerifyChunk {
+	size_t file; // Index into the compared files
+	unsigned long long offset;
+	unsigned int length;
+	bool last;
+};
+
+// Checks that an image is well formed and holds exactly what's in the source
+class ImageVerifier
+{
+public:
+	ImageVerifier(ImageReader& reader);
+
+	void verify_structure();
+	void verify_contents(const char* game_path);
+	unsigned int get_directories_checked();
+	unsigned int get_files_checked();
+	unsigned long long get_bytes_compared();
+
+private:
+	void _compare_chunks();
+
+private:
+	ImageReader& reader;
+	InputSource* source; // Only set while the contents are compared
+	std::vector<ImageEntry> files; // From the UDF tree, ordered by sector
+	std::vector<File*> sources; // Source of every compared file, nullptr if it has none
+	std::vector<VerifyChunk> chunks;
+	std::atomic<size_t> next_chunk;
+	std::atomic<unsigned long long> bytes_compared;
+	unsigned int directories_checked;
+};
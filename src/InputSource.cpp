@@ -0,0 +1,239 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "InputSource.h"
+#include "TarSource.h"
+#include "ImageSource.h"
+#include "Directory.h"
+#include "File.h"
+#include "Checkpoint.h"
+#include "ImageOutput.h"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#endif
+#include <algorithm>
+#include <vector>
+
+constexpr auto COPY_RANGE_MIN_SIZE = 64 * 1024ULL; // Smaller files aren't worth flushing the output for
+
+FileStream::FileStream(FILE* f, unsigned long long start, unsigned long long size) : f(f), start(start), left(size), size(size) {}
+
+FileStream::~FileStream()
+{
+	fclose(f);
+}
+
+// Never reads past the end of the file even if the stream goes on, archive members are followed by other members
+size_t FileStream::read(void* buf, size_t size)
+{
+	auto read_size = (size_t)std::min<unsigned long long>(size, left);
+	auto was_read = fread(buf, 1, read_size, f);
+	left -= was_read;
+	return was_read;
+}
+
+bool FileStream::seek(unsigned long long offset)
+{
+	if (offset > size || seek_image(f, start + offset) != 0) {
+		return false;
+	}
+	left = size - offset;
+	return true;
+}
+
+#ifdef __linux__
+// Shares whole blocks with the source on file systems that can, e.g. btrfs and XFS, only works when both offsets are on a block
+static unsigned long long _clone_blocks(int in_fd, off_t in_offset, int out_fd, off_t out_offset, unsigned long long size)
+{
+	struct statvfs fs;
+	if (fstatvfs(out_fd, &fs) != 0 || fs.f_bsize == 0 || in_offset % fs.f_bsize != 0 || out_offset % fs.f_bsize != 0) {
+		return 0;
+	}
+	auto length = size / fs.f_bsize * fs.f_bsize;
+	if (length == 0) {
+		return 0;
+	}
+	file_clone_range range;
+	range.src_fd = in_fd;
+	range.src_offset = in_offset;
+	range.src_length = length;
+	range.dest_offset = out_offset;
+	return ioctl(out_fd, FICLONERANGE, &range) == 0 ? length : 0;
+}
+#endif
+
+// Lets the kernel move the data between the files, it doesn't go through user space and can be a reflink on some file systems
+unsigned long long FileStream::copy_to(ImageOutput* out, unsigned long long size)
+{
+#ifdef __linux__
+	unsigned long long room;
+	FILE* out_f = out->get_file(room);
+	size = std::min(std::min(size, left), room);
+	if (out_f == nullptr || size < COPY_RANGE_MIN_SIZE || fflush(out_f) != 0) {
+		return 0;
+	}
+	auto position = out->tell();
+	off_t in_offset = start + (this->size - left);
+	off_t out_offset = ftello(out_f);
+	unsigned long long copied = _clone_blocks(fileno(f), in_offset, fileno(out_f), out_offset, size);
+	in_offset += copied;
+	out_offset += copied;
+	while (copied < size) {
+		auto result = copy_file_range(fileno(f), &in_offset, fileno(out_f), &out_offset, size - copied, 0);
+		if (result <= 0) { // Not supported between these files, whatever is left goes through the buffer
+			break;
+		}
+		copied += result;
+	}
+	if (copied != 0) {
+		left -= copied;
+		seek_image(f, in_offset);
+		out->seek(position + copied);
+	}
+	return copied;
+#else
+	return 0;
+#endif
+}
+
+DirectorySource::DirectorySource(const char* path) : path(path) {}
+
+FileTree* DirectorySource::get_files()
+{
+	Directory dir(path.c_str());
+	return dir.get_files();
+}
+
+InputStream* DirectorySource::open(File* file)
+{
+	FILE* f = fopen(file->GetPath().c_str(), "rb");
+	if (f == nullptr) {
+		return nullptr;
+	}
+	return new FileStream(f, 0, file->GetSize());
+}
+
+FileTreeBuilder::FileTreeBuilder() : root(new FileTree(true)) {}
+
+FileTreeBuilder::~FileTreeBuilder()
+{
+	delete root;
+}
+
+File* FileTreeBuilder::add(const std::string& path, bool is_directory, unsigned long long size)
+{
+	// Split without the empty and "." parts so the same file always gets the same path
+	std::vector<std::string> names;
+	size_t start = 0;
+	while (start <= path.size()) {
+		auto end = std::min(path.find('/', start), path.size());
+		auto name = path.substr(start, end - start);
+		start = end + 1;
+		if (name == "..") { // Nothing is allowed to point outside of the tree
+			return nullptr;
+		}
+		if (!name.empty() && name != ".") {
+			names.push_back(name);
+		}
+	}
+	FileTreeNode* parent = nullptr;
+	std::string node_path;
+	for (size_t i = 0; i < names.size(); ++i) {
+		auto& name = names[i];
+		node_path += node_path.empty() ? name : "/" + name;
+		auto last = i + 1 == names.size();
+		auto node = nodes.find(node_path);
+		if (node == nodes.end()) {
+			parent = _add_node(node_path, name, parent, last ? is_directory : true, last ? size : 0);
+			if (last) {
+				return parent->file;
+			}
+			continue;
+		}
+		if (!last) {
+			if (!node->second->file->IsDirectory()) {
+				return nullptr;
+			}
+			parent = node->second;
+			continue;
+		}
+		// Archives can have the same path more than once, the last one wins
+		if (node->second->file->IsDirectory() != is_directory) {
+			return nullptr;
+		}
+		if (!is_directory) {
+			delete node->second->file;
+			node->second->file = new File(false, size, node_path.c_str(), "", name.c_str());
+		}
+		return node->second->file;
+	}
+	return nullptr;
+}
+
+FileTree* FileTreeBuilder::release()
+{
+	auto ft = root;
+	root = new FileTree(true);
+	nodes.clear();
+	return ft;
+}
+
+FileTreeNode* FileTreeBuilder::_add_node(const std::string& path, const std::string& name, FileTreeNode* parent, bool is_directory, unsigned long long size)
+{
+	auto file = new File(is_directory, size, path.c_str(), "", name.c_str());
+	auto node = new FileTreeNode(nullptr, parent, file);
+	if (is_directory) {
+		node->next = new FileTree();
+	}
+	if (parent != nullptr) {
+		node->depth = parent->depth + 1;
+		parent->next->tree.push_back(node);
+	}
+	else {
+		root->tree.push_back(node);
+	}
+	nodes.emplace(path, node);
+	return node;
+}
+
+InputSource* open_input_source(const char* path)
+{
+#ifdef _WIN32
+	auto attributes = GetFileAttributesA(path);
+	auto is_file = attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat sb;
+	auto is_file = stat(path, &sb) == 0 && S_ISREG(sb.st_mode);
+#endif
+	if (is_file) {
+		if (is_disc_image(path)) {
+			return new ImageSource(path);
+		}
+		return new TarSource(path);
+	}
+	return new DirectorySource(path);
+}
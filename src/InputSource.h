@@ -0,0 +1,101 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <map>
+#include <string>
+#include <stdio.h>
+
+class File;
+class ImageOutput;
+struct FileTree;
+struct FileTreeNode;
+
+// Data of a single file of the game, opened by the source the file came from
+class InputStream
+{
+public:
+	virtual ~InputStream() {}
+
+	virtual size_t read(void* buf, size_t size) = 0;
+	virtual bool seek(unsigned long long offset) = 0; // Offset is from the start of the file
+	// Moves up to size bytes straight into the output at its current position, returns how much was copied so the caller reads the rest
+	virtual unsigned long long copy_to(ImageOutput* /*out*/, unsigned long long /*size*/) { return 0; }
+};
+
+// Where the game's files come from, gives the file tree to lay out and the data of every file in it
+class InputSource
+{
+public:
+	virtual ~InputSource() {}
+
+	virtual FileTree* get_files() = 0; // nullptr when nothing can be read, the caller owns the tree
+	virtual InputStream* open(File* file) = 0; // nullptr when the file can't be opened, file must come from this source's last tree
+};
+
+// Files on the disk that are read through stdio
+class FileStream : public InputStream
+{
+public:
+	FileStream(FILE* f, unsigned long long start, unsigned long long size);
+	~FileStream();
+
+	size_t read(void* buf, size_t size) override;
+	bool seek(unsigned long long offset) override;
+	unsigned long long copy_to(ImageOutput* out, unsigned long long size) override;
+
+private:
+	FILE* f;
+	unsigned long long start; // Where the file starts inside f, not 0 for archive members
+	unsigned long long left;
+	unsigned long long size;
+};
+
+// Game dumped into a directory on the disk
+class DirectorySource : public InputSource
+{
+public:
+	DirectorySource(const char* path);
+
+	FileTree* get_files() override;
+	InputStream* open(File* file) override;
+
+private:
+	std::string path;
+};
+
+// Builds the tree out of flat paths the way archives list their members, missing parent directories are created on the way
+class FileTreeBuilder
+{
+public:
+	FileTreeBuilder();
+	~FileTreeBuilder();
+
+	File* add(const std::string& path, bool is_directory, unsigned long long size); // nullptr if the path can't be in the tree
+	FileTree* release();
+
+private:
+	FileTreeNode* _add_node(const std::string& path, const std::string& name, FileTreeNode* parent, bool is_directory, unsigned long long size);
+
+private:
+	FileTree* root;
+	std::map<std::string, FileTreeNode*> nodes; // Every node by its path
+};
+
+// Directory, image or archive depending on what the path points at
+InputSource* open_input_source(const char* path);
@@ -0,0 +1,100 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "IoStatsCollector.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+constexpr auto IO_HISTOGRAM_BUCKETS = sizeof(IoStats::open_histogram) / sizeof(IoStats::open_histogram[0]);
+constexpr auto IO_SLOW_FILES = sizeof(IoStats::slow_files) / sizeof(IoStats::slow_files[0]);
+
+unsigned int _get_histogram_bucket(uint64_t us);
+bool _is_slower(const FileIoTime& t1, const FileIoTime& t2);
+
+IoStatsCollector::IoStatsCollector()
+{
+	reset();
+}
+
+void IoStatsCollector::reset()
+{
+	memset(&totals, 0, sizeof(IoStats));
+	slowest.clear();
+}
+
+void IoStatsCollector::add(const std::string& path, unsigned long long size, const FileTiming& timing)
+{
+	totals.files_amount++;
+	totals.bytes += size;
+	totals.open_us += timing.open_us;
+	totals.read_us += timing.read_us;
+	totals.write_us += timing.write_us;
+	totals.open_histogram[_get_histogram_bucket(timing.open_us)]++;
+	totals.read_histogram[_get_histogram_bucket(timing.read_us)]++;
+	totals.write_histogram[_get_histogram_bucket(timing.write_us)]++;
+
+	FileIoTime file;
+	file.size = size;
+	file.open_us = timing.open_us;
+	file.read_us = timing.read_us;
+	file.write_us = timing.write_us;
+	if (slowest.size() == IO_SLOW_FILES && !_is_slower(file, slowest.front())) {
+		return;
+	}
+	// Long paths keep their end, that's where the file's name is
+	auto start = path.size() >= sizeof(file.path) ? path.size() - sizeof(file.path) + 1 : 0;
+	strncpy(file.path, path.c_str() + start, sizeof(file.path) - 1);
+	file.path[sizeof(file.path) - 1] = '\0';
+	if (slowest.size() == IO_SLOW_FILES) {
+		std::pop_heap(slowest.begin(), slowest.end(), _is_slower);
+		slowest.pop_back();
+	}
+	slowest.push_back(file);
+	std::push_heap(slowest.begin(), slowest.end(), _is_slower);
+}
+
+void IoStatsCollector::fill(IoStats& stats)
+{
+	stats = totals;
+	auto sorted = slowest;
+	std::sort(sorted.begin(), sorted.end(), _is_slower);
+	stats.slow_files_amount = sorted.size();
+	std::copy(sorted.begin(), sorted.end(), stats.slow_files);
+}
+
+uint64_t io_time_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned int _get_histogram_bucket(uint64_t us)
+{
+	unsigned int bucket = 0;
+	while (us != 0 && bucket < IO_HISTOGRAM_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+bool _is_slower(const FileIoTime& t1, const FileIoTime& t2)
+{
+	return t1.open_us + t1.read_us + t1.write_us > t2.open_us + t2.read_us + t2.write_us;
+}
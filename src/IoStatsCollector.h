@@ -0,0 +1,47 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "API.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Where the time of writing one file went, in microseconds
+struct FileTiming {
+	uint64_t open_us;
+	uint64_t read_us;
+	uint64_t write_us;
+};
+
+// Aggregates file timings while packing, only the slowest files are kept with their paths
+class IoStatsCollector
+{
+public:
+	IoStatsCollector();
+
+	void reset();
+	void add(const std::string& path, unsigned long long size, const FileTiming& timing);
+	void fill(IoStats& stats);
+
+private:
+	IoStats totals; // Everything except the slow files, which are kept in the heap until fill
+	std::vector<FileIoTime> slowest; // Min-heap on the total time so the fastest of the slow files is the one to drop
+};
+
+uint64_t io_time_us();
@@ -0,0 +1,86 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "MemorySource.h"
+#include "Directory.h"
+#include "File.h"
+#include <algorithm>
+#include <cstring>
+
+void MemorySource::add_file(const char* path, const void* data, size_t size)
+{
+	MemoryEntry entry;
+	entry.path = path;
+	entry.is_directory = false;
+	entry.data.assign((const char*)data, (const char*)data + size);
+	entries.push_back(std::move(entry));
+}
+
+void MemorySource::add_directory(const char* path)
+{
+	MemoryEntry entry;
+	entry.path = path;
+	entry.is_directory = true;
+	entries.push_back(std::move(entry));
+}
+
+FileTree* MemorySource::get_files()
+{
+	contents.clear();
+	FileTreeBuilder builder;
+	for (auto& entry : entries) {
+		auto file = builder.add(entry.path, entry.is_directory, entry.data.size());
+		if (file == nullptr) {
+			contents.clear();
+			return nullptr;
+		}
+		if (!entry.is_directory) {
+			contents[file] = &entry.data;
+		}
+	}
+	return builder.release();
+}
+
+InputStream* MemorySource::open(File* file)
+{
+	auto data = contents.find(file);
+	if (data == contents.end()) {
+		return nullptr;
+	}
+	return new MemoryStream(*data->second);
+}
+
+MemoryStream::MemoryStream(const std::vector<char>& data) : data(data), position(0) {}
+
+size_t MemoryStream::read(void* buf, size_t size)
+{
+	auto read_size = std::min(size, data.size() - position);
+	memcpy(buf, data.data() + position, read_size);
+	position += read_size;
+	return read_size;
+}
+
+bool MemoryStream::seek(unsigned long long offset)
+{
+	if (offset > data.size()) {
+		return false;
+	}
+	position = (size_t)offset;
+	return true;
+}
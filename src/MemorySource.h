@@ -0,0 +1,55 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "InputSource.h"
+#include <vector>
+
+// Files that only exist in memory, lets tests and benchmarks pack a tree without touching the disk for the input
+class MemorySource : public InputSource
+{
+public:
+	void add_file(const char* path, const void* data, size_t size); // Data is copied
+	void add_directory(const char* path); // Only needed for empty directories, parents of files are created on their own
+
+	FileTree* get_files() override;
+	InputStream* open(File* file) override;
+
+private:
+	struct MemoryEntry {
+		std::string path;
+		bool is_directory;
+		std::vector<char> data;
+	};
+
+	std::vector<MemoryEntry> entries;
+	std::map<File*, const std::vector<char>*> contents;
+};
+
+class MemoryStream : public InputStream
+{
+public:
+	MemoryStream(const std::vector<char>& data);
+
+	size_t read(void* buf, size_t size) override;
+	bool seek(unsigned long long offset) override;
+
+private:
+	const std::vector<char>& data;
+	size_t position;
+};
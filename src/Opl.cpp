@@ -0,0 +1,124 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "Opl.h"
+#include "Directory.h"
+#include "File.h"
+#include "SectorManager.h"
+#include <regex>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <stdio.h>
+
+static std::string _join_path(const std::string& dir, const std::string& name)
+{
+	if (dir.empty() || dir.back() == '/' || dir.back() == '\\') {
+		return dir + name;
+	}
+	return dir + "/" + name;
+}
+
+// Name as it fits in the record, the CRC in the part names is taken over the same bytes
+static std::string _get_entry_name(const char* name)
+{
+	return std::string(name, std::min<size_t>(strlen(name), sizeof(OplGameEntry::name)));
+}
+
+// Same as USBUtil and OPL compute it: the table is filled backwards, the CRC starts from the last value put in it and covers the terminating zero
+unsigned int get_opl_name_crc(const char* name)
+{
+	unsigned int table[256];
+	unsigned int crc = 0;
+	for (unsigned int i = 0; i < 256; ++i) {
+		crc = i << 24;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = crc & 0x80000000 ? crc << 1 : (crc << 1) ^ 0x04C11DB7;
+		}
+		table[255 - i] = crc;
+	}
+	size_t i = 0;
+	do {
+		crc = table[(unsigned char)name[i] ^ (crc >> 24)] ^ (crc << 8);
+	} while (name[i++] != '\0');
+	return crc;
+}
+
+// Boot executable in the root of the disc, OPL knows the game by its name
+std::string get_opl_startup(FileTree* ft)
+{
+	static const std::regex boot_exec("S[A-Z]{3}_[0-9]{3}\\.[0-9]{2}");
+	for (auto node : ft->tree) {
+		auto name = normalize_disc_path(node->file->GetName());
+		if (!node->file->IsDirectory() && std::regex_match(name, boot_exec)) {
+			return name;
+		}
+	}
+	throw ImageMakerException("Can't find the boot executable to name the parts after");
+}
+
+// Parts are ul.<name CRC>.<startup>.<part number>
+std::string get_opl_part_prefix(const std::string& dir, const char* name, const std::string& startup)
+{
+	char file_name[64];
+	snprintf(file_name, sizeof(file_name), "ul.%08X.%s.", get_opl_name_crc(_get_entry_name(name).c_str()), startup.c_str());
+	return _join_path(dir, file_name);
+}
+
+// ul.cfg lists every game on the drive, the record of this one is replaced if it's already there
+void write_opl_config(const std::string& dir, const char* name, const std::string& startup, unsigned int parts)
+{
+	OplGameEntry entry;
+	memset(&entry, 0, sizeof(OplGameEntry));
+	auto entry_name = _get_entry_name(name);
+	memcpy(entry.name, entry_name.data(), entry_name.size());
+	memcpy(entry.magic, "ul.", sizeof(entry.magic));
+	memcpy(entry.startup, startup.data(), std::min(startup.size(), sizeof(entry.startup)));
+	entry.parts = parts;
+	entry.media = OPL_MEDIA_DVD;
+	entry.usbextreme = 0x08;
+
+	auto path = _join_path(dir, "ul.cfg");
+	std::vector<OplGameEntry> entries;
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f != nullptr) {
+		OplGameEntry existing;
+		while (fread(&existing, 1, sizeof(OplGameEntry), f) == sizeof(OplGameEntry)) {
+			entries.push_back(existing);
+		}
+		fclose(f);
+	}
+	auto same_game = std::find_if(entries.begin(), entries.end(), [&entry](const OplGameEntry& existing) {
+		return strncmp(existing.startup, entry.startup, sizeof(entry.startup)) == 0;
+	});
+	if (same_game != entries.end()) {
+		*same_game = entry;
+	}
+	else {
+		entries.push_back(entry);
+	}
+	f = fopen(path.c_str(), "wb");
+	if (f == nullptr) {
+		throw ImageMakerException("Can't create ul.cfg");
+	}
+	auto written = fwrite(entries.data(), sizeof(OplGameEntry), entries.size(), f);
+	if (fclose(f) != 0 || written != entries.size()) {
+		throw ImageMakerException("Can't write ul.cfg");
+	}
+}
@@ -0,0 +1,44 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+
+struct FileTree;
+
+constexpr auto OPL_PART_SIZE = 1024 * 1024 * 1024ULL; // FAT32 can't hold the whole image, Open PS2 Loader reads it in 1 GB parts
+constexpr auto OPL_MEDIA_DVD = 0x14;
+
+#pragma pack(1)
+// Game record in ul.cfg, the USBExtreme format Open PS2 Loader lists split games from
+struct OplGameEntry {
+	char name[32];
+	char magic[3]; // "ul."
+	char startup[12]; // Boot executable, e.g. SLUS_200.01
+	unsigned char parts;
+	unsigned char media; // 0x12 for CD, 0x14 for DVD
+	unsigned char pad[4];
+	unsigned char usbextreme; // Always 0x08
+	unsigned char reserved[10];
+};
+#pragma pack()
+
+unsigned int get_opl_name_crc(const char* name);
+std::string get_opl_startup(FileTree* ft);
+std::string get_opl_part_prefix(const std::string& dir, const char* name, const std::string& startup);
+void write_opl_config(const std::string& dir, const char* name, const std::string& startup, unsigned int parts);
@@ -0,0 +1,110 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "OverlaySource.h"
+#include "SectorManager.h"
+#include "Directory.h"
+#include "File.h"
+
+OverlaySource::OverlaySource(InputSource* base, InputSource* overlay) : base(base), overlay(overlay), base_tree(nullptr), overlay_tree(nullptr), conflict(false) {}
+
+OverlaySource::~OverlaySource()
+{
+	_clear();
+	delete base;
+	delete overlay;
+}
+
+FileTree* OverlaySource::get_files()
+{
+	_clear();
+	base_tree = base->get_files();
+	if (base_tree == nullptr) {
+		return nullptr;
+	}
+	_collect_entries(base_tree, "", base);
+	if (overlay != nullptr) {
+		overlay_tree = overlay->get_files();
+		if (overlay_tree == nullptr) {
+			return nullptr;
+		}
+		_collect_entries(overlay_tree, "", overlay);
+	}
+	if (conflict) {
+		return nullptr;
+	}
+	// Replaced files keep their place and spelling from the base so the tree only changes where it has to
+	FileTreeBuilder builder;
+	for (auto& entry : entries) {
+		auto file = builder.add(entry.path, entry.is_directory, entry.file->GetSize());
+		if (file == nullptr) {
+			return nullptr;
+		}
+		origins[file] = &entry;
+	}
+	return builder.release();
+}
+
+InputStream* OverlaySource::open(File* file)
+{
+	auto origin = origins.find(file);
+	if (origin == origins.end()) {
+		return nullptr;
+	}
+	return origin->second->source->open(origin->second->file);
+}
+
+void OverlaySource::_collect_entries(FileTree* ft, const std::string& path, InputSource* source)
+{
+	for (auto node : ft->tree) {
+		auto node_path = path + node->file->GetName();
+		auto disc_path = normalize_disc_path(node_path);
+		auto index = entry_indices.find(disc_path);
+		if (index == entry_indices.end()) {
+			entry_indices.emplace(disc_path, entries.size());
+			OverlayEntry entry = { node_path, node->file->IsDirectory(), source, node->file };
+			entries.push_back(entry);
+		}
+		else {
+			auto& entry = entries[index->second];
+			if (entry.is_directory != node->file->IsDirectory()) { // A file can't replace a directory or the other way around
+				conflict = true;
+			}
+			else if (!entry.is_directory) {
+				entry.source = source;
+				entry.file = node->file;
+			}
+		}
+		if (node->file->IsDirectory()) {
+			_collect_entries(node->next, node_path + "/", source);
+		}
+	}
+}
+
+void OverlaySource::_clear()
+{
+	origins.clear();
+	entry_indices.clear();
+	entries.clear();
+	conflict = false;
+	delete base_tree;
+	delete overlay_tree;
+	base_tree = nullptr;
+	overlay_tree = nullptr;
+}
@@ -0,0 +1,54 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "InputSource.h"
+#include <vector>
+
+// Files of one source laid over another, used to change a few files of an existing image without unpacking it
+// Files with the same disc path are taken from the overlay, the rest of the overlay is added to the tree
+class OverlaySource : public InputSource
+{
+public:
+	OverlaySource(InputSource* base, InputSource* overlay); // Takes ownership of both, overlay can be nullptr
+	~OverlaySource();
+
+	FileTree* get_files() override;
+	InputStream* open(File* file) override;
+
+private:
+	struct OverlayEntry {
+		std::string path;
+		bool is_directory;
+		InputSource* source;
+		File* file; // From the tree of source
+	};
+
+	void _collect_entries(FileTree* ft, const std::string& path, InputSource* source);
+	void _clear();
+
+private:
+	InputSource* base;
+	InputSource* overlay;
+	FileTree* base_tree;
+	FileTree* overlay_tree;
+	std::vector<OverlayEntry> entries;
+	std::map<std::string, size_t> entry_indices; // By normalized disc path
+	std::map<File*, OverlayEntry*> origins; // Where every file of the merged tree comes from
+	bool conflict;
+};
@@ -0,0 +1,209 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "RawImage.h"
+#include "SectorManager.h"
+#include "Checkpoint.h"
+#include "Trace.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <cstring>
+
+constexpr auto RAW_BATCH_SECTORS = 4096U; // 8 MB read per batch, split between all cores
+constexpr auto EDC_POLY = 0xD8018001U; // 0x8001801B reflected
+constexpr auto ECC_P_OFFSET = 0x81CU;
+constexpr auto ECC_Q_OFFSET = 0x8C8U;
+
+static const unsigned char raw_sync[12] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+
+// EDC is sliced 8 bytes at a time, table k holds the CRC of a byte followed by k zero bytes
+// ECC tables multiply by the generator in GF(2^8) and undo (1 + x) for the second parity byte
+struct RawTables {
+	unsigned int edc[8][256];
+	unsigned char ecc_f[256];
+	unsigned char ecc_b[256];
+
+	RawTables() {
+		for (unsigned int i = 0; i < 256; ++i) {
+			auto edc_value = i;
+			for (int bit = 0; bit < 8; ++bit) {
+				edc_value = (edc_value >> 1) ^ (edc_value & 1 ? EDC_POLY : 0);
+			}
+			edc[0][i] = edc_value;
+			auto f = (i << 1) ^ (i & 0x80 ? 0x11D : 0);
+			ecc_f[i] = (unsigned char)f;
+			ecc_b[i ^ f] = (unsigned char)i;
+		}
+		for (unsigned int i = 0; i < 256; ++i) {
+			for (int k = 1; k < 8; ++k) {
+				edc[k][i] = (edc[k - 1][i] >> 8) ^ edc[0][edc[k - 1][i] & 0xFF];
+			}
+		}
+	}
+};
+static const RawTables tables;
+
+static unsigned int _compute_edc(const unsigned char* data, unsigned int size)
+{
+	unsigned int edc = 0;
+	for (; size >= 8; size -= 8, data += 8) {
+		auto low = edc ^ (data[0] | data[1] << 8 | data[2] << 16 | (unsigned int)data[3] << 24);
+		edc = tables.edc[7][low & 0xFF] ^ tables.edc[6][(low >> 8) & 0xFF] ^ tables.edc[5][(low >> 16) & 0xFF] ^ tables.edc[4][low >> 24] ^
+			tables.edc[3][data[4]] ^ tables.edc[2][data[5]] ^ tables.edc[1][data[6]] ^ tables.edc[0][data[7]];
+	}
+	while (size-- != 0) {
+		edc = (edc >> 8) ^ tables.edc[0][(edc ^ *data++) & 0xFF];
+	}
+	return edc;
+}
+
+// Reed-Solomon product code over the sector from the header on, P runs down 86 columns of 24 bytes and Q along 52 diagonals of 43
+static void _compute_ecc_block(const unsigned char* src, unsigned int major_count, unsigned int minor_count, unsigned int major_mult, unsigned int minor_inc, unsigned char* dest)
+{
+	auto size = major_count * minor_count;
+	for (unsigned int major = 0; major < major_count; ++major) {
+		auto index = (major >> 1) * major_mult + (major & 1);
+		unsigned char ecc_a = 0;
+		unsigned char ecc_b = 0;
+		for (unsigned int minor = 0; minor < minor_count; ++minor) {
+			auto value = src[index];
+			index += minor_inc;
+			if (index >= size) {
+				index -= size;
+			}
+			ecc_a = tables.ecc_f[ecc_a ^ value];
+			ecc_b ^= value;
+		}
+		ecc_a = tables.ecc_b[tables.ecc_f[ecc_a] ^ ecc_b];
+		dest[major] = ecc_a;
+		dest[major + major_count] = ecc_a ^ ecc_b;
+	}
+}
+
+static unsigned char _to_bcd(unsigned int value)
+{
+	return (unsigned char)((value / 10) << 4 | value % 10);
+}
+
+bool fits_raw_addresses(unsigned int total_sectors)
+{
+	return total_sectors <= RAW_MSF_SECTORS - RAW_PREGAP_SECTORS;
+}
+
+void encode_raw_sector(const unsigned char* data, unsigned int lba, RawSectorMode mode, bool last, unsigned char* raw)
+{
+	memcpy(raw, raw_sync, sizeof(raw_sync));
+	auto address = lba + RAW_PREGAP_SECTORS; // Track starts after the pregap
+	raw[12] = _to_bcd(address / (60 * 75));
+	raw[13] = _to_bcd(address / 75 % 60);
+	raw[14] = _to_bcd(address % 75);
+	unsigned char header[4] = {}; // Mode 2 only, saved while the ECC is computed over a zeroed header
+	if (mode == RawSectorMode::RAW_MODE1) {
+		raw[15] = 1;
+		memcpy(raw + 16, data, 2048);
+		auto edc = _compute_edc(raw, 0x810);
+		memcpy(raw + 0x810, &edc, sizeof(edc)); // Little endian like the rest of the disc
+		memset(raw + 0x814, 0, 8);
+	}
+	else {
+		raw[15] = 2;
+		// Subheader is written twice, the last sector ends the record and the file
+		unsigned char subheader[4] = { 0, 0, (unsigned char)(last ? 0x89 : 0x08), 0 };
+		memcpy(raw + 16, subheader, sizeof(subheader));
+		memcpy(raw + 20, subheader, sizeof(subheader));
+		memcpy(raw + 24, data, 2048);
+		auto edc = _compute_edc(raw + 16, 0x808);
+		memcpy(raw + 0x818, &edc, sizeof(edc));
+		// Form 1 doesn't protect the header with ECC so it's taken as zeros
+		memcpy(header, raw + 12, sizeof(header));
+		memset(raw + 12, 0, sizeof(header));
+	}
+	_compute_ecc_block(raw + 12, 86, 24, 2, 86, raw + ECC_P_OFFSET);
+	_compute_ecc_block(raw + 12, 52, 43, 86, 88, raw + ECC_Q_OFFSET);
+	if (mode != RawSectorMode::RAW_MODE1) {
+		memcpy(raw + 12, header, sizeof(header));
+	}
+}
+
+void convert_to_raw(FILE* f, unsigned int total_sectors, RawSectorMode mode)
+{
+	TraceSpan span("Raw sectors");
+	auto threads_amount = std::max(1U, std::thread::hardware_concurrency());
+	std::vector<unsigned char> in(RAW_BATCH_SECTORS * 2048);
+	std::vector<unsigned char> out(RAW_BATCH_SECTORS * RAW_SECTOR_SIZE);
+	// Raw sector i starts at or after where 2048 byte sector i started, going backwards only overwrites sectors already read
+	for (auto end = total_sectors; end != 0;) {
+		auto start = end > RAW_BATCH_SECTORS ? end - RAW_BATCH_SECTORS : 0;
+		auto amount = end - start;
+		if (seek_image(f, (unsigned long long)start * 2048) != 0 || fread(in.data(), 2048, amount, f) != amount) {
+			throw ImageMakerException("Can't read the image back for raw sectors");
+		}
+		auto per_thread = (amount + threads_amount - 1) / threads_amount;
+		std::vector<std::thread> workers;
+		for (unsigned int first = 0; first < amount; first += per_thread) {
+			auto last = std::min(amount, first + per_thread);
+			workers.push_back(std::thread([&, first, last]() {
+				for (auto i = first; i < last; ++i) {
+					encode_raw_sector(&in[i * 2048], start + i, mode, start + i + 1 == total_sectors, &out[i * RAW_SECTOR_SIZE]);
+				}
+			}));
+		}
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		if (seek_image(f, (unsigned long long)start * RAW_SECTOR_SIZE) != 0 || fwrite(out.data(), RAW_SECTOR_SIZE, amount, f) != amount) {
+			throw ImageMakerException("Can't write raw sectors");
+		}
+		end = start;
+	}
+	fflush(f);
+}
+
+void write_cue_sheet(const char* bin_path, RawSectorMode mode)
+{
+	std::string bin_name = bin_path;
+	auto slash = bin_name.find_last_of("/\\");
+	if (slash != std::string::npos) {
+		bin_name = bin_name.substr(slash + 1);
+	}
+	FILE* cue = fopen(get_cue_path(bin_path).c_str(), "w");
+	if (cue == nullptr) {
+		throw ImageMakerException("Can't create the cue sheet");
+	}
+	fprintf(cue, "FILE \"%s\" BINARY\n", bin_name.c_str());
+	fprintf(cue, "  TRACK 01 %s\n", mode == RawSectorMode::RAW_MODE1 ? "MODE1/2352" : "MODE2/2352");
+	fprintf(cue, "    INDEX 01 00:00:00\n");
+	auto failed = ferror(cue) != 0;
+	if (fclose(cue) != 0 || failed) {
+		throw ImageMakerException("Can't write the cue sheet");
+	}
+}
+
+// Extension of the image is swapped for .cue, one is added if it has none
+std::string get_cue_path(const char* bin_path)
+{
+	std::string path = bin_path;
+	auto dot = path.find_last_of('.');
+	auto slash = path.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		path.erase(dot);
+	}
+	return path.append(".cue");
+}
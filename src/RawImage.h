@@ -0,0 +1,37 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "API.h"
+#include <string>
+#include <stdio.h>
+
+constexpr auto RAW_SECTOR_SIZE = 2352U;
+constexpr auto RAW_PREGAP_SECTORS = 150U; // 2 seconds before the track, counted in every sector's address
+constexpr auto RAW_MSF_SECTORS = 100 * 60 * 75U; // Headers address 00:00:00 to 99:59:74 in BCD, nothing past that can be written
+
+// Whether every sector of an image this big gets a valid address
+bool fits_raw_addresses(unsigned int total_sectors);
+
+// Wraps 2048 bytes of user data into a full sector with sync, header, EDC and ECC, lba counts from the start of the track
+void encode_raw_sector(const unsigned char* data, unsigned int lba, RawSectorMode mode, bool last, unsigned char* raw);
+// Grows a finished image of 2048 byte sectors into raw sectors, done in place from the end so nothing is overwritten before it's read
+void convert_to_raw(FILE* f, unsigned int total_sectors, RawSectorMode mode);
+// Single data track cue sheet for the raw image, placed next to it
+void write_cue_sheet(const char* bin_path, RawSectorMode mode);
+std::string get_cue_path(const char* bin_path);
@@ -20,14 +20,26 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 #include "SectorManager.h"
 #include "Directory.h"
 #include "File.h"
+#include "InputSource.h"
+#include "Trace.h"
+#include "IoStatsCollector.h"
 #include <algorithm>
 #include <regex>
 #include <cmath>
 #include <cstring>
 
-SectorManager::SectorManager(FileTree* ft) : current_sector(0L), data_sector(261L), total_sectors(0)
+SectorManager::SectorManager(FileTree* ft, const LayoutOptions& options) : current_sector(0L), total_sectors(0), pad_sectors(0), layer_break(0), file_alignment(std::max(options.file_alignment, 1U))
 {
+	TraceSpan span("SectorManager layout");
 	auto directories = ft->get_dir_amount();
+	if (directories + 1 > 0xFFFF) { // Path table refers to parents with 16 bit numbers
+		throw ImageMakerException("Too many directories for the path table");
+	}
+	// Path tables L, optional L, M and optional M start at 257 right after the anchor, each takes as many sectors as it needs
+	path_table_size = ft->get_path_table_size();
+	path_table_sectors = std::ceil(path_table_size / 2048.0);
+	root_directory_sector = 257 + 4 * path_table_sectors;
+	data_sector = root_directory_sector;
 	auto files = ft->get_file_amount();
 	this->directories_amount = directories + 1; // Adding 1 because root directory must be recorded as well
 	this->files_amount = files;
@@ -35,17 +47,13 @@ SectorManager::SectorManager(FileTree* ft) : current_sector(0L), data_sector(261
 	auto file_set_descriptors = 1;
 	auto terminating_descriptors = 1;
 	auto file_ident_descriptors = ft->get_file_identifiers_amount();
+	directory_record_sectors = directory_records;
+	file_identifier_sectors = file_ident_descriptors;
 	auto file_entry_directories = this->directories_amount;
 	auto file_entry_files = this->files_amount;
-	partition_start_sector = 261 + directory_records;
+	partition_start_sector = root_directory_sector + directory_records;
 	// Offset data sector by however many header sectors will be needed for files and directories
 	data_sector += directory_records + file_set_descriptors + terminating_descriptors + file_ident_descriptors + file_entry_directories + file_entry_files;
-	auto data_sectors = ft->get_files_size() / 2048;
-	total_sectors = data_sector + data_sectors + 1; // End of session descriptor?
-	if (total_sectors % 0x10 != 0) { // Not entirely sure why but the amount of sectors needs to be a multiple of 0x10(16)
-		pad_sectors = (0x10 - total_sectors % 0x10);
-		total_sectors += (0x10 - total_sectors % 0x10); // however many pad sectors and 1 extra end of session descriptor?
-	}
 	// Allocate the data sectors
 	_fill_file_sectors(ft, true);
 	// Fill directories
@@ -54,45 +62,82 @@ SectorManager::SectorManager(FileTree* ft) : current_sector(0L), data_sector(261
 			this->directories.push_back(p.first);
 		}
 	}
-	// Fill files
-	auto cur_tree = ft;
+	// Fill files, their LBAs always follow the sorted order because that's the order their File Entries are written in
 	unsigned int dir_lba = 2 + file_ident_descriptors;
-	unsigned int data_sec = this->data_sector;
 	unsigned int data_lba = dir_lba + this->directories_amount;
-	unsigned int file_local_sector = this->data_sector - 261 - directory_records;
 	for (auto& p : file_sectors) {
 		if (!p.first->file->IsDirectory()) {
+			if (p.first->file->GetSize() > MAX_FILE_SIZE) {
+				throw ImageMakerException("File is too big for an ISO directory record");
+			}
 			this->files.push_back(p.first);
-			p.second.global_sector = data_sec;
 			p.second.lba = data_lba++;
-			p.second.local_sector = file_local_sector;
-			auto sector_space = 0;
-			if (p.first->file->GetSize() % 2048 != 0) {
-				sector_space = (p.first->file->GetSize() + (2048 - p.first->file->GetSize() % 2048)) / 2048;
-			}
-			else {
-				sector_space = p.first->file->GetSize() / 2048;
-			}
-			data_sec += sector_space;
-			file_local_sector += sector_space;
 		}
 	}
+	// Then decide where the actual data goes
+	unsigned int data_end = 0;
+	if (options.dual_layer) {
+		_place_dual_layer(options);
+		data_end = std::max(_place_files(placed_files, data_sector), layer_break + LAYER1_HEADER_SECTORS);
+	}
+	else if (!options.access_profile.empty()) {
+		// Files the game reads go to the end of the disc, that's the outer edge where reading is the fastest
+		std::vector<FileTreeNode*> listed;
+		_split_by_profile(options, placed_files, listed);
+		placed_files.insert(placed_files.end(), listed.begin(), listed.end());
+		data_end = _place_files(placed_files, data_sector);
+	}
+	else {
+		placed_files = this->files;
+		data_end = _place_files(placed_files, data_sector);
+	}
+	total_sectors = data_end + 1; // End of session descriptor?
+	if (total_sectors % 0x10 != 0) { // Not entirely sure why but the amount of sectors needs to be a multiple of 0x10(16)
+		pad_sectors = (0x10 - total_sectors % 0x10);
+		total_sectors += (0x10 - total_sectors % 0x10); // however many pad sectors and 1 extra end of session descriptor?
+	}
+	if (layer_break != 0 && (layer_break > DVD9_LAYER_SECTORS || total_sectors - layer_break > DVD9_LAYER_SECTORS)) {
+		throw ImageMakerException("Data doesn't fit on a dual layer disc");
+	}
 }
 
-void SectorManager::write_file(FILE* out_f, FILE* in_f, void* buf, long file_size, long buffer_size)
+// Timing is only taken when asked for, the clock isn't touched otherwise
+void SectorManager::write_file(ImageOutput* out_f, InputStream* in, void* buf, unsigned long long file_size, unsigned int buffer_size, FileTiming* timing)
 {
-	int sectors_needed = std::ceil(file_size / 2048.0);
-	current_sector += sectors_needed;
+	current_sector += (file_size + 2047) / 2048;
+	auto start = timing != nullptr ? io_time_us() : 0;
+	// A copy stops where the output moves on to its next file, the rest can still be copied from there
 	auto write_left = file_size;
+	for (unsigned long long copied; write_left > 0 && (copied = in->copy_to(out_f, write_left)) != 0;) {
+		write_left -= copied;
+	}
+	if (timing != nullptr) {
+		timing->read_us += io_time_us() - start;
+	}
 
 	while (write_left > 0) {
-		auto write_size = buffer_size;
-		if (write_size > write_left) {
-			write_size = write_left;
+		auto write_size = (size_t)std::min<unsigned long long>(buffer_size, write_left);
+		if (timing != nullptr) {
+			start = io_time_us();
+		}
+		// Mapped images are read into right where the data goes
+		auto data = out_f->get_buffer(write_size);
+		if (data == nullptr) {
+			data = (char*)buf;
+		}
+		if (in->read(data, write_size) != write_size) { // Source changed since it was enumerated
+			throw ImageMakerException("Can't read a file of the game");
 		}
-		fread(buf, 1, write_size, in_f);
-		fwrite(buf, 1, write_size, out_f);
+		if (timing != nullptr) {
+			auto now = io_time_us();
+			timing->read_us += now - start;
+			start = now;
+		}
+		out_f->write(data, write_size);
 		write_left -= write_size;
+		if (timing != nullptr) {
+			timing->write_us += io_time_us() - start;
+		}
 	}
 
 	if (file_size % 2048 != 0) {
@@ -101,11 +146,41 @@ void SectorManager::write_file(FILE* out_f, FILE* in_f, void* buf, long file_siz
 	}
 }
 
-void SectorManager::pad_sector(FILE* f, int padding_size)
+void SectorManager::pad_sector(ImageOutput* f, int padding_size)
 {
 	// Pad to align the sector
-	auto pad = new char[padding_size]();
-	fwrite(pad, 1, padding_size, f);
+	static const char pad[2048] = {};
+	while (padding_size > 0) {
+		auto pad_size = std::min(padding_size, 2048);
+		f->write(pad, pad_size);
+		padding_size -= pad_size;
+	}
+}
+
+// Fill empty sectors until the requested one, used for gaps between data and before the ending sectors
+void SectorManager::pad_to_sector(ImageOutput* f, long sector)
+{
+	while (current_sector < sector) {
+		// Second layer starts with its own copy of volume descriptors so that readers can find where it starts
+		if (layer_break != 0 && !layer_descriptors.empty() && current_sector >= layer_break + 16 && current_sector < layer_break + LAYER1_HEADER_SECTORS) {
+			write_sector<char>(f, layer_descriptors.data() + (current_sector - layer_break - 16) * 2048, 2048);
+		}
+		else {
+			pad_sector(f, 2048);
+			current_sector++;
+		}
+	}
+}
+
+void SectorManager::set_layer_descriptors(const char* descriptors)
+{
+	layer_descriptors.assign(descriptors, descriptors + 2 * 2048);
+}
+
+void SectorManager::seek_sector(ImageOutput* f, long sector)
+{
+	f->seek((unsigned long long)sector * 2048);
+	current_sector = sector;
 }
 
 unsigned int SectorManager::get_total_sectors()
@@ -135,26 +210,17 @@ long SectorManager::get_total_directories()
 
 unsigned int SectorManager::get_file_sector(FileTreeNode* node)
 {
-	auto vec_iter = std::find_if(file_sectors.begin(), file_sectors.end(), [node](std::pair<FileTreeNode*, FileLocation> p) {
-		return p.first == node;
-	});
-	return (*vec_iter).second.global_sector;
+	return _get_location(node).global_sector;
 }
 
 unsigned int SectorManager::get_file_lba(FileTreeNode* node)
 {
-	auto vec_iter = std::find_if(file_sectors.begin(), file_sectors.end(), [node](std::pair<FileTreeNode*, FileLocation> p) {
-		return p.first == node;
-	});
-	return (*vec_iter).second.lba;
+	return _get_location(node).lba;
 }
 
 unsigned int SectorManager::get_file_local_sector(FileTreeNode* node)
 {
-	auto vec_iter = std::find_if(file_sectors.begin(), file_sectors.end(), [node](std::pair<FileTreeNode*, FileLocation> p) {
-		return p.first == node;
-	});
-	return (*vec_iter).second.local_sector;
+	return _get_location(node).local_sector;
 }
 
 unsigned int SectorManager::get_pad_sectors()
@@ -162,16 +228,79 @@ unsigned int SectorManager::get_pad_sectors()
 	return pad_sectors;
 }
 
-std::vector<FileTreeNode*> SectorManager::get_directories()
+unsigned int SectorManager::get_data_sector()
+{
+	return data_sector;
+}
+
+unsigned int SectorManager::get_path_table_size()
+{
+	return path_table_size;
+}
+
+unsigned int SectorManager::get_path_table_sectors()
+{
+	return path_table_sectors;
+}
+
+unsigned int SectorManager::get_root_directory_sector()
+{
+	return root_directory_sector;
+}
+
+unsigned int SectorManager::get_directory_record_sectors()
+{
+	return directory_record_sectors;
+}
+
+unsigned int SectorManager::get_file_identifier_sectors()
+{
+	return file_identifier_sectors;
+}
+
+unsigned int SectorManager::get_layer_break()
+{
+	return layer_break;
+}
+
+// FNV-1a over everything that decides where bytes end up in the image
+unsigned long long SectorManager::get_layout_hash()
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	auto hash_bytes = [&hash](const void* data, size_t size) {
+		auto bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001B3ULL;
+		}
+	};
+	hash_bytes(&total_sectors, sizeof(total_sectors));
+	hash_bytes(&partition_start_sector, sizeof(partition_start_sector));
+	for (auto& p : file_sectors) {
+		auto& path = p.first->file->GetPath();
+		auto size = p.first->file->GetSize();
+		hash_bytes(path.c_str(), path.size() + 1);
+		hash_bytes(&size, sizeof(size));
+		hash_bytes(&p.second, sizeof(FileLocation));
+	}
+	return hash;
+}
+
+const std::vector<FileTreeNode*>& SectorManager::get_directories() const
 {
 	return directories;
 }
 
-std::vector<FileTreeNode*> SectorManager::get_files()
+const std::vector<FileTreeNode*>& SectorManager::get_files() const
 {
 	return files;
 }
 
+const std::vector<FileTreeNode*>& SectorManager::get_placed_files() const
+{
+	return placed_files;
+}
+
 void SectorManager::_fill_file_sectors(FileTree* ft, bool root)
 {
 	for (auto node : ft->tree) {
@@ -183,27 +312,17 @@ void SectorManager::_fill_file_sectors(FileTree* ft, bool root)
 	// Need to sort the map but only by the initial caller
 	if (!root) return;
 	// Sort by depth and name
-	std::sort(file_sectors.begin(), file_sectors.end(), [](std::pair<FileTreeNode*, FileLocation> dir1, std::pair<FileTreeNode*, FileLocation> dir2) {
-		auto dir1_path = dir1.first->file->GetPath();
-		auto dir2_path = dir2.first->file->GetPath();
-
+	std::sort(file_sectors.begin(), file_sectors.end(), [](const std::pair<FileTreeNode*, FileLocation>& dir1, const std::pair<FileTreeNode*, FileLocation>& dir2) {
 		if (dir1.first->depth == dir2.first->depth) {
-			std::regex regexp("[\\\\/]");
-			std::sregex_token_iterator dir1_match(dir1_path.begin(), dir1_path.end(), regexp, -1);
-			std::sregex_token_iterator dir2_match(dir2_path.begin(), dir2_path.end(), regexp, -1);
-			std::sregex_token_iterator end;
-			while (dir1_match != end && dir2_match != end) {
-				if (strcmp((*dir1_match).str().c_str(), (*dir2_match).str().c_str()) != 0) {
-					return strcmp((*dir1_match).str().c_str(), (*dir2_match).str().c_str()) < 0;
-				}
-				dir1_match++;
-				dir2_match++;
-			}
+			return compare_disc_paths(dir1.first->file->GetPath(), dir2.first->file->GetPath()) < 0;
 		}
 		return dir1.first->depth < dir2.first->depth;
 	});
-	unsigned int directory_record_sector = 262;
-	unsigned int dir_lba = 3 + ft->get_file_identifiers_amount(); // Directory LBA starts 2 sectors from FileSetDescriptor + 1 since we record root in code later
+	for (size_t i = 0; i < file_sectors.size(); ++i) {
+		file_indices[file_sectors[i].first] = i;
+	}
+	unsigned int directory_record_sector = root_directory_sector + ft->get_directory_records_layout().sectors;
+	unsigned int dir_lba = 3 + file_identifier_sectors; // Directory LBA starts 2 sectors from FileSetDescriptor + 1 since we record root in code later
 	for (auto& file_sector : file_sectors) {
 		// If it's a directory use directory records sectors
 		if (file_sector.first->file->IsDirectory()) {
@@ -213,3 +332,218 @@ void SectorManager::_fill_file_sectors(FileTree* ft, bool root)
 		}
 	}
 }
+
+// Split the files between the layers without splitting any file by the layer break
+void SectorManager::_place_dual_layer(const LayoutOptions& options)
+{
+	std::vector<FileTreeNode*> hot_files;
+	std::vector<FileTreeNode*> cold_files;
+	unsigned int hot_sectors = 0;
+	unsigned long long data_sectors = 0;
+	if (!options.access_profile.empty()) { // Profile knows better what is hot
+		_split_by_profile(options, cold_files, hot_files);
+	}
+	else {
+		for (auto node : files) {
+			if (_is_hot_file(node, options)) {
+				hot_files.push_back(node);
+			}
+			else {
+				cold_files.push_back(node);
+			}
+		}
+	}
+	for (auto node : hot_files) {
+		hot_sectors += _get_placed_space(node);
+	}
+	for (auto node : files) {
+		data_sectors += _get_placed_space(node);
+	}
+	auto configured = options.layer_break != 0;
+	unsigned long long target = options.layer_break;
+	if (configured) {
+		if (options.layer_break % 0x10 != 0) {
+			throw ImageMakerException("Layer break must be a multiple of 16 sectors");
+		}
+		if (options.layer_break < data_sector + hot_sectors) {
+			throw ImageMakerException("Layer break leaves no space for header sectors on the first layer");
+		}
+	}
+	else {
+		// Split the data in half, first layer gets the extra because pressed discs need it to be the bigger one
+		target = (data_sector + data_sectors + LAYER1_HEADER_SECTORS + 1) / 2;
+	}
+	// Sorted files fill the first layer, hot files go right before the layer break. With opposite track path the second
+	// layer continues from the outer edge so everything that is read often sits around where both layers meet
+	size_t split = 0;
+	unsigned long long layer0_end = data_sector + hot_sectors;
+	for (; split < cold_files.size(); ++split) {
+		auto sectors = _get_placed_space(cold_files[split]);
+		if (configured ? layer0_end + sectors > target : layer0_end >= target) {
+			break;
+		}
+		layer0_end += sectors;
+	}
+	if (configured) {
+		layer_break = options.layer_break;
+	}
+	else {
+		while (split > 0 && layer0_end + (0x10 - layer0_end % 0x10) % 0x10 > DVD9_LAYER_SECTORS) {
+			layer0_end -= _get_placed_space(cold_files[--split]);
+		}
+		layer_break = layer0_end + (0x10 - layer0_end % 0x10) % 0x10; // Second layer's descriptors are searched at 16 sector boundaries
+	}
+	placed_files.assign(cold_files.begin(), cold_files.begin() + split);
+	placed_files.insert(placed_files.end(), hot_files.begin(), hot_files.end());
+	placed_files.insert(placed_files.end(), cold_files.begin() + split, cold_files.end());
+}
+
+// Assign data sectors in the given order, returns the sector right after the last file
+unsigned int SectorManager::_place_files(const std::vector<FileTreeNode*>& order, unsigned long long sector)
+{
+	// Empty files take no sectors so there's nothing to align for them
+	auto align = [this](unsigned long long sector, unsigned long long sectors) {
+		return sectors == 0 ? sector : (sector + file_alignment - 1) / file_alignment * file_alignment;
+	};
+	for (auto node : order) {
+		auto sectors = node->file->GetSectorsSpace();
+		sector = align(sector, sectors);
+		// Never split a file with the layer break, just move it to the second layer
+		if (layer_break != 0 && sector < layer_break + LAYER1_HEADER_SECTORS && (sector >= layer_break || sector + sectors > layer_break)) {
+			sector = align(layer_break + LAYER1_HEADER_SECTORS, sectors);
+		}
+		auto& location = _get_location(node);
+		location.global_sector = sector;
+		location.local_sector = sector - partition_start_sector;
+		sector += sectors;
+		if (sector + 0x10 > MAX_IMAGE_SECTORS) { // Room for the padding and the end of session descriptor
+			throw ImageMakerException("Data doesn't fit in 32 bit sector numbers");
+		}
+	}
+	return sector;
+}
+
+// Sectors a file takes up to where the next aligned file can start
+unsigned long long SectorManager::_get_placed_space(FileTreeNode* node)
+{
+	auto sectors = node->file->GetSectorsSpace();
+	return (sectors + file_alignment - 1) / file_alignment * file_alignment;
+}
+
+// Split the files into the ones the profile never saw, kept sorted, and the ones it did in the order they should be laid out
+void SectorManager::_split_by_profile(const LayoutOptions& options, std::vector<FileTreeNode*>& unlisted, std::vector<FileTreeNode*>& listed)
+{
+	struct Access {
+		size_t first; // Index of the first read in the profile
+		size_t count;
+	};
+	std::unordered_map<std::string, Access> accesses;
+	for (size_t i = 0; i < options.access_profile.size(); ++i) {
+		auto it = accesses.find(options.access_profile[i]);
+		if (it == accesses.end()) {
+			Access access = { i, 1 };
+			accesses.emplace(options.access_profile[i], access);
+		}
+		else {
+			it->second.count++;
+		}
+	}
+	std::vector<std::pair<FileTreeNode*, Access>> read_files;
+	for (auto node : files) {
+		auto it = accesses.find(_get_relative_path(node));
+		if (it == accesses.end()) {
+			unlisted.push_back(node);
+		}
+		else {
+			read_files.push_back(std::pair<FileTreeNode*, Access>(node, it->second));
+		}
+	}
+	// Files that are read more often are pushed further out, inside the same tier they follow the order they were first read in
+	// so files that are loaded together end up next to each other
+	auto tier = [](size_t count) {
+		auto tier = 0;
+		while (count >>= 1) ++tier;
+		return tier;
+	};
+	std::stable_sort(read_files.begin(), read_files.end(), [&tier](const std::pair<FileTreeNode*, Access>& f1, const std::pair<FileTreeNode*, Access>& f2) {
+		if (tier(f1.second.count) != tier(f2.second.count)) {
+			return tier(f1.second.count) < tier(f2.second.count);
+		}
+		return f1.second.first < f2.second.first;
+	});
+	for (auto& p : read_files) {
+		listed.push_back(p.first);
+	}
+}
+
+// Files that get read all the time during the game's boot and play
+bool SectorManager::_is_hot_file(FileTreeNode* node, const LayoutOptions& options)
+{
+	auto name = normalize_disc_path(node->file->GetName());
+	if (!options.hot_files.empty()) {
+		auto path = _get_relative_path(node);
+		for (auto& hot_file : options.hot_files) {
+			auto hot = normalize_disc_path(hot_file);
+			if (hot == name || hot == path) {
+				return true;
+			}
+		}
+		return false;
+	}
+	// Boot config, executables and IOP modules
+	static const std::regex boot_exec("S[A-Z]{3}_[0-9]{3}\\.[0-9]{2}");
+	if (name == "SYSTEM.CNF" || std::regex_match(name, boot_exec)) {
+		return true;
+	}
+	auto ext = name.size() > 4 ? name.substr(name.size() - 4) : "";
+	return ext == ".ELF" || ext == ".IRX";
+}
+
+// Path from the root of the disc in the same form normalize_disc_path gives
+std::string SectorManager::_get_relative_path(FileTreeNode* node)
+{
+	auto path = node->file->GetName();
+	for (auto parent = node->parent; parent != nullptr; parent = parent->parent) {
+		path = parent->file->GetName() + "/" + path;
+	}
+	return normalize_disc_path(path);
+}
+
+FileLocation& SectorManager::_get_location(FileTreeNode* node)
+{
+	return file_sectors[file_indices.at(node)].second;
+}
+
+// Upper case, forward slashes, no leading slash and no ISO version suffix, so paths from any source can be compared
+std::string normalize_disc_path(std::string path)
+{
+	std::transform(path.begin(), path.end(), path.begin(), ::toupper);
+	std::replace(path.begin(), path.end(), '\\', '/');
+	auto version = path.find(';');
+	if (version != std::string::npos) {
+		path.erase(version);
+	}
+	auto start = path.find_first_not_of('/');
+	return start == std::string::npos ? std::string() : path.substr(start);
+}
+
+// Files are split into extents of the same length with the remainder in the last one, an empty file still has one
+unsigned int get_extents_amount(unsigned long long size)
+{
+	return size == 0 ? 1 : (size + MAX_EXTENT_SIZE - 1) / MAX_EXTENT_SIZE;
+}
+
+// Compares paths one directory at a time, separators sort before any other character so "A/B" comes before "A.B"
+int compare_disc_paths(const std::string& path1, const std::string& path2)
+{
+	auto length = std::min(path1.size(), path2.size());
+	for (size_t i = 0; i < length; ++i) {
+		unsigned char c1 = (path1[i] == '/' || path1[i] == '\\') ? 0 : path1[i];
+		unsigned char c2 = (path2[i] == '/' || path2[i] == '\\') ? 0 : path2[i];
+		if (c1 != c2) {
+			return c1 < c2 ? -1 : 1;
+		}
+	}
+	if (path1.size() == path2.size()) return 0;
+	return path1.size() < path2.size() ? -1 : 1;
+}
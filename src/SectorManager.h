@@ -21,10 +21,15 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 #include <exception>
 #include <vector>
 #include <map>
+#include <string>
+#include <unordered_map>
 #include <stdio.h>
+#include "ImageOutput.h"
 
 struct FileTree;
 struct FileTreeNode;
+class InputStream;
+struct FileTiming;
 
 struct FileLocation {
 	unsigned int global_sector; // starting from the top of the disc
@@ -32,6 +37,25 @@ struct FileLocation {
 	unsigned int lba; // starting from FileIdentifierDescriptor sector
 };
 
+constexpr auto DVD9_LAYER_SECTORS = 2086912U; // Max amount of sectors a single layer of a dual layer disc can hold
+constexpr auto LAYER1_HEADER_SECTORS = 18U; // 16 system sectors, volume descriptor and its terminator at the start of the second layer
+constexpr auto MAX_FILE_SIZE = 0xFFFFFFFFULL; // ISO directory records hold 32 bit sizes
+constexpr auto MAX_EXTENT_SIZE = 0x3FFFF800U; // UDF extent lengths are 30 bit, all but the last extent must be whole blocks
+constexpr auto MAX_IMAGE_SECTORS = 0xFFFFFFFFULL; // Volume space size and every LBA are 32 bit
+
+// Options that control where the data ends up on the disc
+struct LayoutOptions {
+	bool dual_layer = false;
+	unsigned int layer_break = 0; // Sector where the second layer starts, 0 to pick automatically
+	std::vector<std::string> hot_files; // Names or paths relative to the root, empty to pick automatically
+	std::vector<std::string> access_profile; // Paths relative to the root in the order the game reads them, repeats included
+	unsigned int file_alignment = 1; // Sectors, every file's data starts on a multiple of it
+};
+
+std::string normalize_disc_path(std::string path);
+int compare_disc_paths(const std::string& path1, const std::string& path2);
+unsigned int get_extents_amount(unsigned long long size);
+
 class ImageMakerException : public std::exception
 {
 public:
@@ -53,12 +77,15 @@ class SectorManager
 {
 public:
 
-	SectorManager(FileTree* ft);
+	SectorManager(FileTree* ft, const LayoutOptions& options = LayoutOptions());
 
 	template<typename T>
-	void write_sector(FILE* f, T* data, unsigned int size = sizeof(T));
-	void write_file(FILE* out_f, FILE* in_f, void* buf, long file_size, long buffer_size);
-	void pad_sector(FILE* f, int padding_size);
+	void write_sector(ImageOutput* f, T* data, unsigned int size = sizeof(T));
+	void write_file(ImageOutput* out_f, InputStream* in, void* buf, unsigned long long file_size, unsigned int buffer_size, FileTiming* timing = nullptr);
+	void pad_sector(ImageOutput* f, int padding_size);
+	void seek_sector(ImageOutput* f, long sector);
+	void pad_to_sector(ImageOutput* f, long sector);
+	void set_layer_descriptors(const char* descriptors);
 	unsigned int get_total_sectors();
 	long get_current_sector();
 	unsigned int get_partition_start_sector();
@@ -68,11 +95,27 @@ public:
 	unsigned int get_file_lba(FileTreeNode* node);
 	unsigned int get_file_local_sector(FileTreeNode* node);
 	unsigned int get_pad_sectors();
-	std::vector<FileTreeNode*> get_directories();
-	std::vector<FileTreeNode*> get_files();
+	unsigned int get_data_sector();
+	unsigned int get_directory_record_sectors();
+	unsigned int get_file_identifier_sectors();
+	unsigned int get_path_table_size();
+	unsigned int get_path_table_sectors();
+	unsigned int get_root_directory_sector();
+	unsigned int get_layer_break();
+	unsigned long long get_layout_hash();
+	const std::vector<FileTreeNode*>& get_directories() const;
+	const std::vector<FileTreeNode*>& get_files() const;
+	const std::vector<FileTreeNode*>& get_placed_files() const;
 
 private:
 	void _fill_file_sectors(FileTree* ft, bool root);
+	void _place_dual_layer(const LayoutOptions& options);
+	unsigned int _place_files(const std::vector<FileTreeNode*>& order, unsigned long long sector);
+	unsigned long long _get_placed_space(FileTreeNode* node);
+	void _split_by_profile(const LayoutOptions& options, std::vector<FileTreeNode*>& unlisted, std::vector<FileTreeNode*>& listed);
+	bool _is_hot_file(FileTreeNode* node, const LayoutOptions& options);
+	std::string _get_relative_path(FileTreeNode* node);
+	FileLocation& _get_location(FileTreeNode* node);
 
 private:
 	long current_sector;
@@ -82,20 +125,30 @@ private:
 	unsigned int total_sectors;
 	unsigned int partition_start_sector;
 	unsigned int pad_sectors; // Amount of pad sectors to put in the end
+	unsigned int layer_break; // 0 for single layer discs
+	unsigned int file_alignment;
+	unsigned int directory_record_sectors;
+	unsigned int file_identifier_sectors;
+	unsigned int path_table_size;
+	unsigned int path_table_sectors; // Of each of the 4 copies
+	unsigned int root_directory_sector; // Root's directory records follow the path tables, other directories follow the root
 	std::vector<std::pair<FileTreeNode*, FileLocation>> file_sectors;
+	std::unordered_map<FileTreeNode*, size_t> file_indices; // Index of each node in file_sectors
 	std::vector<FileTreeNode*> directories;
-	std::vector<FileTreeNode*> files;
+	std::vector<FileTreeNode*> files; // In the order of their LBAs
+	std::vector<FileTreeNode*> placed_files; // In the order their data is written on the disc
+	std::vector<char> layer_descriptors;
 };
 
 template<typename T>
-inline void SectorManager::write_sector(FILE* f, T* data, unsigned int size)
+inline void SectorManager::write_sector(ImageOutput* f, T* data, unsigned int size)
 {
 	if (size > 2048) {
 		throw ImageMakerException("Can't write to sector more than sector's size");
 	}
 	
 	// Write the data
-	fwrite(data, 1, size, f);
+	f->write(data, size);
 	//f.write(reinterpret_cast<char*>(data), size);
 
 
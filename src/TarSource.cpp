@@ -0,0 +1,204 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "TarSource.h"
+#include "Directory.h"
+#include "File.h"
+#include "Checkpoint.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+
+constexpr auto TAR_BLOCK_SIZE = 512U;
+constexpr auto TAR_MAX_LONG_NAME = 64 * 1024U; // Nothing in a game comes close, protects from reading a huge member into memory
+
+unsigned long long _parse_tar_number(const unsigned char* field, size_t size);
+std::string _parse_tar_string(const unsigned char* field, size_t size);
+void _parse_pax_header(const std::vector<char>& data, std::string& path, unsigned long long& size, bool& has_size);
+
+TarSource::TarSource(const char* path) : path(path) {}
+
+FileTree* TarSource::get_files()
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == nullptr) {
+		return nullptr;
+	}
+	offsets.clear();
+	FileTreeBuilder builder;
+	unsigned char header[TAR_BLOCK_SIZE];
+	unsigned long long offset = 0;
+	std::string long_name; // Name of the next member from a GNU long name or a pax header
+	unsigned long long pax_size = 0;
+	bool has_pax_size = false;
+	auto archive_size = get_image_size(f);
+	seek_image(f, 0);
+	bool damaged = false;
+	while (_read_header(f, header, damaged)) {
+		offset += TAR_BLOCK_SIZE;
+		auto size = _parse_tar_number(header + 124, 12);
+		auto type = header[156];
+		auto data_blocks = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+		if (type == 'L' || type == 'x') {
+			std::vector<char> data((size_t)std::min<unsigned long long>(size, TAR_MAX_LONG_NAME));
+			if (size > TAR_MAX_LONG_NAME || fread(data.data(), 1, data.size(), f) != data.size()) {
+				damaged = true;
+				break;
+			}
+			if (type == 'L') {
+				long_name.assign(data.data(), strnlen(data.data(), data.size()));
+			}
+			else {
+				_parse_pax_header(data, long_name, pax_size, has_pax_size);
+			}
+		}
+		else if (type != 'K' && type != 'g') { // Long link names and global pax headers don't belong to the next member
+			if (has_pax_size) {
+				size = pax_size;
+				data_blocks = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+			}
+			auto name = long_name;
+			if (name.empty()) {
+				name = _parse_tar_string(header, 100);
+				auto prefix = _parse_tar_string(header + 345, 155);
+				if (!memcmp(header + 257, "ustar", 5) && !prefix.empty()) {
+					name = prefix + "/" + name;
+				}
+			}
+			long_name.clear();
+			has_pax_size = false;
+			// Links and devices have nothing to put on a disc
+			if (type == '0' || type == '\0' || type == '7') {
+				auto file = builder.add(name, false, size);
+				if (file != nullptr) {
+					offsets[file] = offset;
+				}
+			}
+			else if (type == '5') {
+				builder.add(name, true, 0);
+			}
+		}
+		offset += data_blocks;
+		if (offset - data_blocks + size > archive_size || seek_image(f, offset) != 0) { // Cut short in the middle of a member
+			damaged = true;
+			break;
+		}
+	}
+	fclose(f);
+	if (damaged) {
+		offsets.clear();
+		return nullptr;
+	}
+	return builder.release();
+}
+
+InputStream* TarSource::open(File* file)
+{
+	auto offset = offsets.find(file);
+	if (offset == offsets.end()) {
+		return nullptr;
+	}
+	// Every stream gets its own handle so files can be read from several threads
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == nullptr) {
+		return nullptr;
+	}
+	if (seek_image(f, offset->second) != 0) {
+		fclose(f);
+		return nullptr;
+	}
+	return new FileStream(f, offset->second, file->GetSize());
+}
+
+// False at the end of the archive, damaged is set if it isn't a proper end
+bool TarSource::_read_header(FILE* f, unsigned char* header, bool& damaged)
+{
+	auto was_read = fread(header, 1, TAR_BLOCK_SIZE, f);
+	if (was_read != TAR_BLOCK_SIZE) {
+		damaged = was_read != 0; // Archives without the closing empty blocks are still fine
+		return false;
+	}
+	// Checksum is computed with its own field filled with spaces
+	unsigned int sum = 0;
+	bool empty = true;
+	for (unsigned int i = 0; i < TAR_BLOCK_SIZE; ++i) {
+		sum += (i >= 148 && i < 156) ? ' ' : header[i];
+		empty = empty && header[i] == 0;
+	}
+	if (empty) {
+		return false;
+	}
+	damaged = sum != _parse_tar_number(header + 148, 8);
+	return !damaged;
+}
+
+// Octal text, GNU tar stores sizes past 8 GiB as big endian binary with the top bit set
+unsigned long long _parse_tar_number(const unsigned char* field, size_t size)
+{
+	unsigned long long value = 0;
+	if (field[0] & 0x80) {
+		value = field[0] & 0x7F;
+		for (size_t i = 1; i < size; ++i) {
+			value = (value << 8) | field[i];
+		}
+		return value;
+	}
+	size_t i = 0;
+	while (i < size && field[i] == ' ') ++i;
+	for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i) {
+		value = (value << 3) | (field[i] - '0');
+	}
+	return value;
+}
+
+std::string _parse_tar_string(const unsigned char* field, size_t size)
+{
+	return std::string((const char*)field, strnlen((const char*)field, size));
+}
+
+// Records are "<length> <key>=<value>\n", only the ones that change where the member goes matter here
+void _parse_pax_header(const std::vector<char>& data, std::string& path, unsigned long long& size, bool& has_size)
+{
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t len = 0;
+		auto i = pos;
+		while (i < data.size() && data[i] >= '0' && data[i] <= '9') {
+			len = len * 10 + (data[i++] - '0');
+		}
+		if (len == 0 || pos + len > data.size() || i >= data.size() || data[i] != ' ') {
+			return;
+		}
+		std::string record(data.data() + i + 1, pos + len - i - 2); // Without the space and the newline
+		pos += len;
+		auto eq = record.find('=');
+		if (eq == std::string::npos) {
+			continue;
+		}
+		auto key = record.substr(0, eq);
+		if (key == "path") {
+			path = record.substr(eq + 1);
+		}
+		else if (key == "size") {
+			size = strtoull(record.c_str() + eq + 1, nullptr, 10);
+			has_size = true;
+		}
+	}
+}
@@ -0,0 +1,38 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "InputSource.h"
+
+// Game packed into an uncompressed tar archive, files are read straight out of it so nothing has to be extracted
+// The layout doesn't follow the archive's order so the archive is indexed by walking its headers first, it can't be a pipe
+class TarSource : public InputSource
+{
+public:
+	TarSource(const char* path);
+
+	FileTree* get_files() override;
+	InputStream* open(File* file) override;
+
+private:
+	bool _read_header(FILE* f, unsigned char* header, bool& damaged);
+
+private:
+	std::string path;
+	std::map<File*, unsigned long long> offsets; // Where the data of every file starts in the archive
+};
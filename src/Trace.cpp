@@ -0,0 +1,140 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "Trace.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+
+std::atomic<bool> tracing(false);
+std::chrono::steady_clock::time_point trace_start;
+std::mutex trace_buffers_mut;
+std::vector<TraceBuffer*> trace_buffers; // Kept for the whole run, threads that are gone still have their events in them
+thread_local TraceBuffer* thread_trace_buffer = nullptr;
+
+uint64_t _trace_now();
+void _write_json_string(FILE* f, const char* str);
+
+TraceSpan::TraceSpan(const char* name, const char* detail) : name(name), begin(0), active(tracing)
+{
+	if (active) {
+		if (detail != nullptr) {
+			this->detail = detail;
+		}
+		begin = _trace_now();
+	}
+}
+
+TraceSpan::~TraceSpan()
+{
+	end();
+}
+
+void TraceSpan::end()
+{
+	if (!active) {
+		return;
+	}
+	active = false;
+	auto end = _trace_now();
+	if (thread_trace_buffer == nullptr) {
+		std::lock_guard<std::mutex> guard(trace_buffers_mut);
+		thread_trace_buffer = new TraceBuffer();
+		thread_trace_buffer->thread_id = trace_buffers.size() + 1;
+		trace_buffers.push_back(thread_trace_buffer);
+	}
+	TraceEvent event;
+	event.name = name;
+	event.detail.swap(detail);
+	event.begin = begin;
+	event.end = end;
+	thread_trace_buffer->events.push_back(std::move(event));
+}
+
+void start_trace()
+{
+	std::lock_guard<std::mutex> guard(trace_buffers_mut);
+	for (auto buffer : trace_buffers) {
+		buffer->events.clear();
+	}
+	trace_start = std::chrono::steady_clock::now();
+	tracing = true;
+}
+
+// Complete events ("ph":"X") carry both ends so the viewer doesn't have to pair them up
+bool stop_trace(const char* path)
+{
+	tracing = false;
+	std::lock_guard<std::mutex> guard(trace_buffers_mut);
+	FILE* f = fopen(path, "w");
+	if (f == nullptr) {
+		return false;
+	}
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+	bool first = true;
+	for (auto buffer : trace_buffers) {
+		fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"PS2ImageMaker %u\"}}",
+			first ? "" : ",", buffer->thread_id, buffer->thread_id);
+		first = false;
+		for (auto& event : buffer->events) {
+			fputs(",\n{\"name\":", f);
+			_write_json_string(f, event.name);
+			fprintf(f, ",\"cat\":\"pack\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu", buffer->thread_id,
+				(unsigned long long)event.begin, (unsigned long long)(event.end - event.begin));
+			if (!event.detail.empty()) {
+				fputs(",\"args\":{\"detail\":", f);
+				_write_json_string(f, event.detail.c_str());
+				fputs("}", f);
+			}
+			fputs("}", f);
+		}
+		buffer->events.clear();
+	}
+	fputs("\n]}\n", f);
+	return fclose(f) == 0;
+}
+
+bool is_tracing()
+{
+	return tracing;
+}
+
+uint64_t _trace_now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_start).count();
+}
+
+void _write_json_string(FILE* f, const char* str)
+{
+	fputc('"', f);
+	for (auto c = (const unsigned char*)str; *c != '\0'; ++c) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', f);
+			fputc(*c, f);
+		}
+		else if (*c < 0x20) {
+			fprintf(f, "\\u%04x", *c);
+		}
+		else {
+			fputc(*c, f);
+		}
+	}
+	fputc('"', f);
+}
@@ -0,0 +1,57 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Piece of work done on one thread, times are in microseconds from the start of the trace
+struct TraceEvent {
+	const char* name; // Always a literal so recording doesn't allocate for it
+	std::string detail; // E.g. the file being written, empty if there's nothing to add
+	uint64_t begin;
+	uint64_t end;
+};
+
+// Every thread records into its own buffer so spans never wait on each other
+struct TraceBuffer {
+	unsigned int thread_id;
+	std::vector<TraceEvent> events;
+};
+
+// Records the time from construction until end() or destruction, while tracing is off it's only a flag check
+class TraceSpan
+{
+public:
+	TraceSpan(const char* name, const char* detail = nullptr);
+	~TraceSpan();
+
+	void end();
+
+private:
+	const char* name;
+	std::string detail;
+	uint64_t begin;
+	bool active;
+};
+
+void start_trace();
+// Writes everything recorded as Chrome trace event JSON, threads that record must be done by then
+bool stop_trace(const char* path);
+bool is_tracing();
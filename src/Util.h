@@ -18,6 +18,7 @@ along with this program.If not, see < https://www.gnu.org/licenses/>.
 
 #pragma once
 // Mostly functions provided by UDF standard like CRC checksum calculation and unicode compression
+// Functions are inline so both the writer and the reader can include this
 
 /***********************************************************************
  * OSTA compliant Unicode compression, uncompression routines.
@@ -48,7 +49,7 @@ typedef unsigned char byte;
  * The number of unicode characters which were uncompressed.
  * A -1 is returned if the compression ID is invalid.
  */
-int UncompressUnicode(
+inline int UncompressUnicode(
 	int numberOfBytes, /* (Input) number of bytes read from media. */
 	byte* UDFCompressed, /* (Input) bytes read from media. */
 	unicode_t* unicode) /* (Output) uncompressed unicode characters. */
@@ -107,7 +108,7 @@ int UncompressUnicode(
  * including the compression ID.
  * A -1 is returned if the compression ID is invalid.
  */
-int CompressUnicode(
+inline int CompressUnicode(
 	int numberOfChars, /* (Input) number of unicode characters. */
 	int compID, /* (Input) compression ID to be used. */
 	unicode_t* unicode, /* (Input) unicode characters to compress. */
@@ -180,14 +181,14 @@ static unsigned short crc_table[256] = {
  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
 };
 
-unsigned short cksum(unsigned char* s, int n)
+inline unsigned short cksum(unsigned char* s, int n)
 {
 	register unsigned short crc = 0;
 	while (n-- > 0)
 		crc = crc_table[(crc >> 8 ^ *s++) & 0xff] ^ (crc << 8);
 	return crc;
 }
-byte cksum_tag(unsigned char* s, int n) {
+inline byte cksum_tag(unsigned char* s, int n) {
 	register unsigned char checksum = 0;
 	for (int i = 0; i < n; ++i) {
 		if (i == 4) continue;
@@ -196,7 +197,7 @@ byte cksum_tag(unsigned char* s, int n) {
 	return checksum;
 }
 /* UNICODE Checksum */
-unsigned short unicode_cksum(unsigned short* s, int n)
+inline unsigned short unicode_cksum(unsigned short* s, int n)
 {
 	unsigned short crc = 0;
 	while (n-- > 0) {
@@ -216,7 +217,7 @@ unsigned short unicode_cksum(unsigned short* s, int n)
  * data covered by the checksum (48 bytes).
  *
  */
-unsigned short ComputeEAChecksum(byte* data)
+inline unsigned short ComputeEAChecksum(byte* data)
 {
 	unsigned short checksum = 0;
 	unsigned int count;
@@ -227,13 +228,13 @@ unsigned short ComputeEAChecksum(byte* data)
 	return(checksum);
 }
 
-unsigned short changeEndianness16(unsigned short val)
+inline unsigned short changeEndianness16(unsigned short val)
 {
 	return (val << 8) |          // left-shift always fills with zeros
 		((val >> 8) & 0x00ff); // right-shift sign-extends, so force to zero
 }
 
-unsigned int changeEndianness32(unsigned int val)
+inline unsigned int changeEndianness32(unsigned int val)
 {
 	return (val << 24) |
 		((val << 8) & 0x00ff0000) |
@@ -0,0 +1,147 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#include "pch.h"
+#include "VirtualImage.h"
+#include "SectorManager.h"
+#include "SectorDescriptors.h"
+#include "ImageOutput.h"
+#include "InputSource.h"
+#include "Directory.h"
+#include "File.h"
+#include <algorithm>
+#include <cstring>
+
+// Internal parts of API.cpp, metadata is made exactly the same way a pack writes it
+void write_sectors(SectorManager& sm, ImageOutput* f, FileTree* ft);
+void fill_end_of_session(SectorManager& sm, EndOfSessionDescriptor& eos);
+
+// Copies whatever part of the region at region_offset the read overlaps
+static void _copy_region(const char* region, unsigned long long region_size, unsigned long long region_offset, unsigned long long offset, size_t size, char* buffer)
+{
+	auto from = std::max(region_offset, offset);
+	auto to = std::min(region_offset + region_size, offset + size);
+	if (from < to) {
+		memcpy(buffer + (from - offset), region + (from - region_offset), to - from);
+	}
+}
+
+VirtualImage::VirtualImage(InputSource* source, const LayoutOptions& options) : source(source), end_sector(2048), stream_file(0), stream_offset(0)
+{
+	ft.reset(source->get_files());
+	if (ft == nullptr) {
+		throw ImageMakerException("Can't read the files of the game");
+	}
+	sm.reset(new SectorManager(ft.get(), options));
+	for (auto node : sm->get_placed_files()) { // Already in the order of their sectors
+		if (node->file->GetSize() != 0) {
+			files.push_back(node);
+			file_offsets.push_back((unsigned long long)sm->get_file_sector(node) * 2048);
+		}
+	}
+	EndOfSessionDescriptor eos;
+	fill_end_of_session(*sm, eos);
+	memcpy(end_sector.data(), &eos, sizeof(EndOfSessionDescriptor));
+}
+
+VirtualImage::~VirtualImage() {}
+
+unsigned long long VirtualImage::get_size()
+{
+	return (unsigned long long)sm->get_total_sectors() * 2048;
+}
+
+// Reads past the end of the image or from files that can't be read anymore fail as a whole
+bool VirtualImage::read(unsigned long long offset, size_t size, void* buffer)
+{
+	std::lock_guard<std::mutex> guard(mut);
+	if (offset > get_size() || size > get_size() - offset) {
+		return false;
+	}
+	auto bytes = (char*)buffer;
+	auto overlaps = [offset, size](unsigned long long region_offset, unsigned long long region_size) {
+		return region_offset < offset + size && offset < region_offset + region_size;
+	};
+	// Gaps between files, pad sectors and the rest of every file's last sector are all zeros
+	memset(bytes, 0, size);
+	try {
+		auto metadata_size = (unsigned long long)sm->get_data_sector() * 2048;
+		auto layer_descriptors = (unsigned long long)(sm->get_layer_break() + 16) * 2048;
+		if (overlaps(0, metadata_size)) {
+			_render_metadata();
+			_copy_region(metadata->get_data().data(), metadata->get_data().size(), 0, offset, size, bytes);
+		}
+		// Second layer starts with a copy of the volume descriptors
+		if (sm->get_layer_break() != 0 && overlaps(layer_descriptors, 2 * 2048)) {
+			_render_metadata();
+			_copy_region(metadata->get_data().data() + 16 * 2048, 2 * 2048, layer_descriptors, offset, size, bytes);
+		}
+	}
+	catch (const ImageMakerException&) {
+		return false;
+	}
+	_copy_region(end_sector.data(), end_sector.size(), get_size() - 2048, offset, size, bytes);
+	return _read_files(offset, size, bytes);
+}
+
+// Made all at once the first time it's needed and kept, it's only a small part of the image
+void VirtualImage::_render_metadata()
+{
+	if (metadata != nullptr) {
+		return;
+	}
+	std::unique_ptr<MemoryOutput> output(new MemoryOutput());
+	write_sectors(*sm, output.get(), ft.get());
+	metadata.swap(output);
+}
+
+// Files are found by where their data starts, only the ones the read overlaps are opened
+bool VirtualImage::_read_files(unsigned long long offset, size_t size, char* buffer)
+{
+	size_t i = std::upper_bound(file_offsets.begin(), file_offsets.end(), offset) - file_offsets.begin();
+	if (i > 0) {
+		--i;
+	}
+	for (; i < files.size() && file_offsets[i] < offset + size; ++i) {
+		auto from = std::max(file_offsets[i], offset);
+		auto to = std::min(file_offsets[i] + files[i]->file->GetSize(), offset + size);
+		if (from >= to) { // Read is in the padding after the file
+			continue;
+		}
+		auto file_offset = from - file_offsets[i];
+		if (stream == nullptr || stream_file != i) {
+			stream.reset(source->open(files[i]->file));
+			stream_file = i;
+			stream_offset = 0;
+			if (stream == nullptr) {
+				return false;
+			}
+		}
+		if (stream_offset != file_offset && !stream->seek(file_offset)) {
+			stream.reset();
+			return false;
+		}
+		auto read_size = (size_t)(to - from);
+		if (stream->read(buffer + (from - offset), read_size) != read_size) {
+			stream.reset();
+			return false;
+		}
+		stream_offset = file_offset + read_size;
+	}
+	return true;
+}
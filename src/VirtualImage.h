@@ -0,0 +1,58 @@
+/*
+PS2ImageMaker - Library for creating Playstation 2 (PS2)compatible images
+Copyright(C) 2020 Vladislav Smyshlyaev(Smartkin)
+
+This program is free software : you can redistribute it and /or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct FileTree;
+struct FileTreeNode;
+struct LayoutOptions;
+class InputSource;
+class InputStream;
+class SectorManager;
+class MemoryOutput;
+
+// Image that's never written, its bytes are made from the layout and the game's files when they are read
+class VirtualImage
+{
+public:
+	VirtualImage(InputSource* source, const LayoutOptions& options); // Takes ownership of the source
+	~VirtualImage();
+
+	unsigned long long get_size();
+	bool read(unsigned long long offset, size_t size, void* buffer);
+
+private:
+	void _render_metadata();
+	bool _read_files(unsigned long long offset, size_t size, char* buffer);
+
+private:
+	std::unique_ptr<InputSource> source;
+	std::unique_ptr<FileTree> ft;
+	std::unique_ptr<SectorManager> sm;
+	std::unique_ptr<MemoryOutput> metadata; // Everything before the data, only made once something in it is read
+	std::vector<char> end_sector;
+	std::vector<FileTreeNode*> files; // Files with data in the order it's laid out
+	std::vector<unsigned long long> file_offsets; // Where each file's data starts in the image
+	std::unique_ptr<InputStream> stream; // Last file that was read, reads mostly go through a file front to back
+	size_t stream_file;
+	unsigned long long stream_offset;
+	std::mutex mut;
+};
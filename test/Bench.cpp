@@ -0,0 +1,394 @@
+// Bench.cpp : Times every phase of packing a synthetic game tree and prints the results as JSON.
+//
+// Usage: PS2ImageMakerBench [--files N] [--depth N] [--fanout N] [--name-min N] [--name-max N]
+//                           [--size-min BYTES] [--size-max BYTES] [--size-dist uniform|log] [--seed N]
+//                           [--buffer BYTES] [--source directory|memory] [--backend stdio|mmap] [--dir PATH] [--image PATH] [--json PATH] [--keep]
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <API.h>
+#include <Directory.h>
+#include <File.h>
+#include <SectorManager.h>
+#include <ImageOutput.h>
+#include <Checkpoint.h>
+#include <InputSource.h>
+#include <MemorySource.h>
+#include <SectorDescriptors.h>
+#include <Util.h>
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#define remove_dir(path) _rmdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir(path, 0755)
+#define remove_dir(path) rmdir(path)
+#endif
+
+// Internal parts of API.cpp, the bench is built from the library's sources so they can be called directly
+void write_sectors(SectorManager& sm, ImageOutput* f, FileTree* ft);
+void write_file_tree(SectorManager& sm, ImageOutput* f, InputSource* source, long first_file, CheckpointJournal* journal);
+void write_end_sectors(SectorManager& sm, ImageOutput* f);
+unsigned int write_fid(SectorManager& sm, char* buffer, FileTreeNode* node, unsigned int cur_spec_lba);
+
+struct BenchOptions {
+    unsigned int files = 2000;
+    unsigned int depth = 3;
+    unsigned int fanout = 4;
+    unsigned int name_min = 4;
+    unsigned int name_max = 12;
+    unsigned long long size_min = 0;
+    unsigned long long size_max = 1024 * 1024;
+    bool log_sizes = true; // Games have a lot of small files and a few huge ones
+    unsigned long long seed = 1;
+    unsigned int buffer = 32 * 1024 * 1024U;
+    bool memory = false; // Tree is kept in memory so only the writing side touches the disk
+    bool mapped = false; // Image is written through a mapping instead of stdio, only where mmap exists
+    std::string dir = "bench_tree";
+    std::string image = "bench.iso";
+    std::string json;
+    bool keep = false;
+};
+
+// Tiny generator with the same output on every platform, std distributions are allowed to differ between implementations
+struct BenchRandom {
+    unsigned long long state;
+
+    BenchRandom(unsigned long long seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    unsigned long long next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    unsigned long long range(unsigned long long min, unsigned long long max) {
+        return max <= min ? min : min + next() % (max - min + 1);
+    }
+
+    double unit() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+struct GeneratedTree {
+    std::vector<std::string> directories; // In creation order
+    std::vector<std::string> files;
+    unsigned long long bytes = 0;
+};
+
+using BenchClock = std::chrono::steady_clock;
+
+double elapsed_ms(BenchClock::time_point start) {
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+std::string random_name(BenchRandom& rnd, const BenchOptions& options, std::set<std::string>& taken) {
+    const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    std::string name;
+    do {
+        name.clear();
+        auto len = rnd.range(options.name_min, options.name_max);
+        for (unsigned long long i = 0; i < len; ++i) {
+            name.push_back(chars[rnd.next() % (sizeof(chars) - 1)]);
+        }
+    } while (!taken.insert(name).second);
+    return name;
+}
+
+unsigned long long random_size(BenchRandom& rnd, const BenchOptions& options) {
+    if (!options.log_sizes) {
+        return rnd.range(options.size_min, options.size_max);
+    }
+    auto min = std::log(options.size_min + 1.0);
+    auto max = std::log(options.size_max + 1.0);
+    return (unsigned long long)std::exp(min + (max - min) * rnd.unit()) - 1;
+}
+
+// Directories get fanout children on every level up to depth, files are spread over all of them
+// With a memory source nothing is created on the disk and the paths are relative to the tree's root
+bool generate_tree(const BenchOptions& options, GeneratedTree& tree, MemorySource* memory) {
+    BenchRandom rnd(options.seed);
+    if (memory == nullptr && make_dir(options.dir.c_str()) != 0) {
+        return false;
+    }
+    auto root = memory != nullptr ? std::string() : options.dir;
+    std::vector<std::string> level = { root };
+    std::vector<std::string> all_dirs = { root };
+    for (unsigned int d = 0; d < options.depth; ++d) {
+        std::vector<std::string> next_level;
+        for (size_t i = 0; i < level.size(); ++i) {
+            std::set<std::string> names;
+            for (unsigned int j = 0; j < options.fanout; ++j) {
+                auto path = level[i] + "/" + random_name(rnd, options, names);
+                if (memory != nullptr) {
+                    memory->add_directory(path.c_str());
+                }
+                else {
+                    make_dir(path.c_str());
+                }
+                tree.directories.push_back(path);
+                next_level.push_back(path);
+            }
+        }
+        level = next_level;
+        all_dirs.insert(all_dirs.end(), level.begin(), level.end());
+    }
+    std::vector<std::set<std::string>> taken(all_dirs.size()); // File names already used in each directory
+    std::vector<char> pattern(64 * 1024);
+    for (auto& c : pattern) {
+        c = (char)rnd.next();
+    }
+    for (unsigned int i = 0; i < options.files; ++i) {
+        auto dir_index = rnd.next() % all_dirs.size();
+        auto path = all_dirs[dir_index] + "/" + random_name(rnd, options, taken[dir_index]) + ".DAT";
+        auto size = random_size(rnd, options);
+        tree.files.push_back(path);
+        tree.bytes += size;
+        if (memory != nullptr) {
+            std::vector<char> data((size_t)size);
+            for (size_t written = 0; written < data.size(); written += pattern.size()) {
+                memcpy(data.data() + written, pattern.data(), std::min(pattern.size(), data.size() - written));
+            }
+            memory->add_file(path.c_str(), data.data(), data.size());
+            continue;
+        }
+        FILE* f = fopen(path.c_str(), "wb");
+        if (f == nullptr) {
+            return false;
+        }
+        for (unsigned long long written = 0; written < size; written += pattern.size()) {
+            fwrite(pattern.data(), 1, (size_t)std::min<unsigned long long>(pattern.size(), size - written), f);
+        }
+        fclose(f);
+    }
+    return true;
+}
+
+void remove_tree(const BenchOptions& options, const GeneratedTree& tree) {
+    for (auto& file : tree.files) {
+        remove(file.c_str());
+    }
+    for (auto it = tree.directories.rbegin(); it != tree.directories.rend(); ++it) {
+        remove_dir(it->c_str());
+    }
+    remove_dir(options.dir.c_str());
+}
+
+bool parse_options(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keep") {
+            options.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--files") options.files = std::stoul(value);
+        else if (arg == "--depth") options.depth = std::stoul(value);
+        else if (arg == "--fanout") options.fanout = std::stoul(value);
+        else if (arg == "--name-min") options.name_min = std::stoul(value);
+        else if (arg == "--name-max") options.name_max = std::stoul(value);
+        else if (arg == "--size-min") options.size_min = std::stoull(value);
+        else if (arg == "--size-max") options.size_max = std::stoull(value);
+        else if (arg == "--size-dist") options.log_sizes = value == "log";
+        else if (arg == "--seed") options.seed = std::stoull(value);
+        else if (arg == "--buffer") options.buffer = std::stoul(value);
+        else if (arg == "--source") options.memory = value == "memory";
+        else if (arg == "--backend") options.mapped = value == "mmap";
+        else if (arg == "--dir") options.dir = value;
+        else if (arg == "--image") options.image = value;
+        else if (arg == "--json") options.json = value;
+        else return false;
+    }
+    return options.name_min > 0 && options.name_min <= options.name_max && options.size_min <= options.size_max;
+}
+
+// Mapped images need their size up front, it's what the layout came up with
+ImageOutput* open_output(const BenchOptions& options, unsigned long long size) {
+#ifndef _WIN32
+    if (options.mapped) {
+        return new MappedOutput(options.image.c_str(), size, false);
+    }
+#endif
+    return new FileOutput(options.image.c_str(), false);
+}
+
+void collect_nodes(FileTree* ft, std::vector<FileTreeNode*>& nodes) {
+    for (auto node : ft->tree) {
+        nodes.push_back(node);
+        if (node->file->IsDirectory()) {
+            collect_nodes(node->next, nodes);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        std::fprintf(stderr, "Invalid arguments, see the top of Bench.cpp for usage\n");
+        return 1;
+    }
+    GeneratedTree generated;
+    MemorySource* memory = options.memory ? new MemorySource() : nullptr;
+    InputSource* source = memory != nullptr ? (InputSource*)memory : new DirectorySource(options.dir.c_str());
+#ifdef _WIN32
+    options.mapped = false;
+#endif
+    auto start = BenchClock::now();
+    if (!generate_tree(options, generated, memory)) {
+        std::fprintf(stderr, "Can't generate the tree in %s, it must not exist yet\n", options.dir.c_str());
+        return 1;
+    }
+    auto generate_time = elapsed_ms(start);
+    set_file_buffer(options.buffer);
+
+    // Same steps pack() goes through, each one timed on its own
+    start = BenchClock::now();
+    FileTree* ft = source->get_files();
+    auto enumerate_time = elapsed_ms(start);
+    if (ft == nullptr) {
+        std::fprintf(stderr, "Can't enumerate %s\n", options.dir.c_str());
+        return 1;
+    }
+    ImageOutput* image = nullptr;
+    SectorManager* sm = nullptr;
+    double layout_time, metadata_time, file_tree_time, end_time;
+    try {
+        start = BenchClock::now();
+        sm = new SectorManager(ft);
+        layout_time = elapsed_ms(start);
+        image = open_output(options, (unsigned long long)sm->get_total_sectors() * 2048);
+        start = BenchClock::now();
+        write_sectors(*sm, image, ft);
+        metadata_time = elapsed_ms(start);
+        start = BenchClock::now();
+        write_file_tree(*sm, image, source, 0, nullptr);
+        file_tree_time = elapsed_ms(start);
+        start = BenchClock::now();
+        write_end_sectors(*sm, image);
+        image->close();
+        end_time = elapsed_ms(start);
+    }
+    catch (const ImageMakerException& e) { // Tree doesn't fit what the library can lay out
+        std::fprintf(stderr, "Packing failed: %s\n", e.what());
+        delete image;
+        remove(options.image.c_str());
+        if (!options.keep && memory == nullptr) {
+            remove_tree(options, generated);
+        }
+        return 1;
+    }
+    delete image;
+    auto total_sectors = sm->get_total_sectors();
+    auto directories = sm->get_total_directories();
+    auto files = sm->get_total_files();
+
+    // Microbenchmarks
+    std::vector<unsigned char> sector(2048);
+    for (size_t i = 0; i < sector.size(); ++i) {
+        sector[i] = (unsigned char)(i * 31);
+    }
+    const int cksum_rounds = 20000;
+    unsigned int cksum_sink = 0;
+    start = BenchClock::now();
+    for (int i = 0; i < cksum_rounds; ++i) {
+        sector[0] = (unsigned char)i;
+        cksum_sink += cksum(sector.data(), sector.size());
+    }
+    auto cksum_time = elapsed_ms(start);
+
+    std::vector<FileTreeNode*> nodes;
+    collect_nodes(ft, nodes);
+    std::vector<char> fid_buffer(4096);
+    start = BenchClock::now();
+    for (auto node : nodes) {
+        std::fill(fid_buffer.begin(), fid_buffer.begin() + node->get_file_identifier_length(), '\0');
+        write_fid(*sm, fid_buffer.data(), node, 2);
+    }
+    auto fid_time = elapsed_ms(start);
+
+    std::vector<std::string> paths;
+    for (auto node : nodes) {
+        paths.push_back(node->file->GetPath());
+    }
+    std::reverse(paths.begin(), paths.end());
+    start = BenchClock::now();
+    std::sort(paths.begin(), paths.end(), [](const std::string& p1, const std::string& p2) {
+        return compare_disc_paths(p1, p2) < 0;
+    });
+    auto sort_time = elapsed_ms(start);
+
+    // Largest file copied on its own so the number doesn't depend on the tree's shape
+    auto largest = std::max_element(nodes.begin(), nodes.end(), [](FileTreeNode* n1, FileTreeNode* n2) {
+        return n1->file->GetSize() < n2->file->GetSize();
+    });
+    double write_file_time = 0;
+    unsigned long long write_file_size = 0;
+    if (largest != nodes.end() && !(*largest)->file->IsDirectory()) {
+        write_file_size = (*largest)->file->GetSize();
+        std::vector<char> buffer(options.buffer);
+        InputStream* in = source->open((*largest)->file);
+        ImageOutput* out = open_output(options, (write_file_size + 2047) / 2048 * 2048);
+        start = BenchClock::now();
+        sm->write_file(out, in, buffer.data(), write_file_size, options.buffer);
+        out->close();
+        write_file_time = elapsed_ms(start);
+        delete out;
+        delete in;
+    }
+    delete sm;
+    delete ft;
+    delete source;
+    remove(options.image.c_str());
+    if (!options.keep && !options.memory) {
+        remove_tree(options, generated);
+    }
+
+    auto total_time = enumerate_time + layout_time + metadata_time + file_tree_time + end_time;
+    auto rate = [](double bytes, double ms) { return ms > 0 ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0; };
+    char json[4096];
+    std::snprintf(json, sizeof(json),
+        "{\n"
+        "  \"backend\": \"%s\",\n"
+        "  \"source\": \"%s\",\n"
+        "  \"options\": {\"files\": %u, \"depth\": %u, \"fanout\": %u, \"name_min\": %u, \"name_max\": %u, "
+        "\"size_min\": %llu, \"size_max\": %llu, \"size_dist\": \"%s\", \"seed\": %llu, \"buffer\": %u},\n"
+        "  \"tree\": {\"files\": %ld, \"directories\": %ld, \"bytes\": %llu, \"total_sectors\": %u, \"generate_ms\": %.3f},\n"
+        "  \"phases_ms\": {\"enumerate\": %.3f, \"layout\": %.3f, \"metadata\": %.3f, \"write_file_tree\": %.3f, "
+        "\"end_sectors\": %.3f, \"total\": %.3f},\n"
+        "  \"throughput_mb_s\": %.3f,\n"
+        "  \"micro\": {\"cksum_sector_ns\": %.3f, \"write_fid_ns\": %.3f, \"layout_sort_ms\": %.3f, "
+        "\"write_file_bytes\": %llu, \"write_file_mb_s\": %.3f, \"checksum_sink\": %u}\n"
+        "}\n",
+        options.mapped ? "mmap" : "stdio",
+        options.memory ? "memory" : "directory",
+        options.files, options.depth, options.fanout, options.name_min, options.name_max,
+        options.size_min, options.size_max, options.log_sizes ? "log" : "uniform", options.seed, options.buffer,
+        files, directories, generated.bytes, total_sectors, generate_time,
+        enumerate_time, layout_time, metadata_time, file_tree_time, end_time, total_time,
+        rate(total_sectors * 2048.0, total_time),
+        cksum_time * 1e6 / cksum_rounds, nodes.empty() ? 0.0 : fid_time * 1e6 / nodes.size(), sort_time,
+        write_file_size, rate(write_file_size, write_file_time), cksum_sink);
+    std::fputs(json, stdout);
+    if (!options.json.empty()) {
+        FILE* out = fopen(options.json.c_str(), "w");
+        if (out != nullptr) {
+            std::fputs(json, out);
+            fclose(out);
+        }
+    }
+    return 0;
+}
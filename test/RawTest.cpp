@@ -0,0 +1,45 @@
+// RawTest.cpp : Encodes raw sectors at both ends of the address range and checks their headers, and that bigger images are refused.
+//
+// Usage: PS2ImageMakerRawTest
+
+#include <cstdio>
+#include <vector>
+#include <API.h>
+#include <RawImage.h>
+
+// Minute, second and frame of the sector's header in BCD plus its mode
+bool check_header(unsigned int lba, RawSectorMode mode, const unsigned char expected[4]) {
+    std::vector<unsigned char> data(2048, 0x5A);
+    std::vector<unsigned char> raw(RAW_SECTOR_SIZE);
+    encode_raw_sector(data.data(), lba, mode, false, raw.data());
+    for (int i = 0; i < 4; ++i) {
+        if (raw[12 + i] != expected[i]) {
+            std::printf("FAILED: Header of LBA %u is %02X %02X %02X %02X\n", lba, raw[12], raw[13], raw[14], raw[15]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    const unsigned char first[4] = { 0x00, 0x02, 0x00, 0x02 };
+    const unsigned char last[4] = { 0x99, 0x59, 0x74, 0x02 };
+    const unsigned char last_mode1[4] = { 0x99, 0x59, 0x74, 0x01 };
+    auto last_lba = RAW_MSF_SECTORS - RAW_PREGAP_SECTORS - 1;
+    if (!check_header(0, RawSectorMode::RAW_MODE2_FORM1, first) ||
+        !check_header(last_lba, RawSectorMode::RAW_MODE2_FORM1, last) ||
+        !check_header(last_lba, RawSectorMode::RAW_MODE1, last_mode1)) {
+        return 1;
+    }
+    // Images are only written when their last sector still has an address
+    if (!fits_raw_addresses(last_lba + 1)) {
+        std::printf("FAILED: Image of %u sectors was refused\n", last_lba + 1);
+        return 1;
+    }
+    if (fits_raw_addresses(last_lba + 2)) {
+        std::printf("FAILED: Image of %u sectors was accepted\n", last_lba + 2);
+        return 1;
+    }
+    std::printf("PASSED: Last raw sector is LBA %u at 99:59:74\n", last_lba);
+    return 0;
+}
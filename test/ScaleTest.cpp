@@ -0,0 +1,144 @@
+// ScaleTest.cpp : Packs a tree with more files than fit in 16 bit addressing and checks every metadata LBA on the disc.
+//
+// Usage: PS2ImageMakerScaleTest [--files N] [--per-dir N] [--image PATH] [--keep]
+
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <API.h>
+#include <Directory.h>
+#include <File.h>
+#include <SectorManager.h>
+#include <ImageOutput.h>
+#include <Checkpoint.h>
+#include <MemorySource.h>
+#include <ImageReader.h>
+#include <ImageVerifier.h>
+#include <SectorDescriptors.h>
+
+// Internal parts of API.cpp, the test is built from the library's sources so they can be called directly
+void write_sectors(SectorManager& sm, ImageOutput* f, FileTree* ft);
+void write_file_tree(SectorManager& sm, ImageOutput* f, InputSource* source, long first_file, CheckpointJournal* journal);
+void write_end_sectors(SectorManager& sm, ImageOutput* f);
+
+struct ScaleOptions {
+    unsigned int files = 100000;
+    unsigned int per_dir = 2500; // Big enough for multi sector directories on both sides
+    std::string image = "scale_test.iso";
+    bool keep = false;
+};
+
+bool parse_options(int argc, char** argv, ScaleOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keep") {
+            options.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--files") options.files = std::stoul(value);
+        else if (arg == "--per-dir") options.per_dir = std::stoul(value);
+        else if (arg == "--image") options.image = value;
+        else return false;
+    }
+    return options.per_dir > 0;
+}
+
+// Most files are empty so the image is mostly metadata, every 16th one has data to keep the data area in play
+void generate_tree(const ScaleOptions& options, MemorySource& memory) {
+    std::vector<char> data(2048, 'S');
+    char path[64];
+    for (unsigned int i = 0; i < options.files; ++i) {
+        snprintf(path, sizeof(path), "DATA%03u/FILE%06u.BIN", i / options.per_dir, i);
+        memory.add_file(path, data.data(), i % 16 == 0 ? i % data.size() + 1 : 0);
+    }
+}
+
+int fail(const char* message, unsigned int value) {
+    std::printf("FAILED: %s (%u)\n", message, value);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    ScaleOptions options;
+    if (!parse_options(argc, argv, options)) {
+        std::fprintf(stderr, "Invalid arguments, see the top of ScaleTest.cpp for usage\n");
+        return 1;
+    }
+    MemorySource memory;
+    generate_tree(options, memory);
+    FileTree* ft = memory.get_files();
+    if (ft == nullptr) {
+        std::fprintf(stderr, "Can't build the tree\n");
+        return 1;
+    }
+    SectorManager sm(ft);
+    try {
+        FileOutput image(options.image.c_str(), false);
+        write_sectors(sm, &image, ft);
+        write_file_tree(sm, &image, &memory, 0, nullptr);
+        write_end_sectors(sm, &image);
+    }
+    catch (const ImageMakerException& e) {
+        std::printf("FAILED: %s\n", e.what());
+        remove(options.image.c_str());
+        return 1;
+    }
+
+    // LBAs handed out by the layout have to be one after another and go past what 16 bits can hold
+    auto& files = sm.get_files();
+    auto& directories = sm.get_directories();
+    if (files.size() != options.files) {
+        return fail("Layout lost files", files.size());
+    }
+    auto expected_lba = sm.get_file_lba(directories.back()) + 1;
+    for (auto node : files) {
+        if (sm.get_file_lba(node) != expected_lba++) {
+            return fail("File entry LBAs aren't consecutive at", sm.get_file_lba(node));
+        }
+    }
+    if (options.files > 0xFFFF && expected_lba <= 0xFFFF) {
+        return fail("Last LBA doesn't need more than 16 bits", expected_lba);
+    }
+
+    // Every file entry on the disc has to be where the layout put it and say so in its tag
+    int result = 0;
+    {
+        ImageReader reader(options.image.c_str());
+        ImageVerifier verifier(reader);
+        verifier.verify_structure();
+        auto partition_start = reader.get_partition_start_sector();
+        ulong previous_id = 0;
+        for (auto node : files) {
+            auto lba = sm.get_file_lba(node);
+            auto fe = (const FileEntry*)reader.get_sector(partition_start + lba);
+            if (fe == nullptr || fe->tag.tag_location != lba || fe->ext_attrib_hd.tag.tag_location != lba) {
+                result = fail("File entry doesn't match its LBA", lba);
+                break;
+            }
+            if (fe->unique_id <= previous_id) {
+                result = fail("Unique id isn't increasing at LBA", lba);
+                break;
+            }
+            previous_id = fe->unique_id;
+        }
+        if (result == 0 && reader.get_errors_amount() != 0) {
+            std::printf("FAILED: %u errors in the image, first one: %s\n", reader.get_errors_amount(), reader.get_errors()[0].c_str());
+            result = 1;
+        }
+        if (result == 0 && verifier.get_files_checked() != options.files) {
+            result = fail("Verifier didn't find every file", verifier.get_files_checked());
+        }
+    }
+    if (result == 0) {
+        std::printf("PASSED: %u files in %zu directories, last LBA %u, %u sectors\n", options.files, directories.size(), expected_lba - 1, sm.get_total_sectors());
+    }
+    if (!options.keep) {
+        remove(options.image.c_str());
+    }
+    return result;
+}
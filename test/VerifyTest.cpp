@@ -0,0 +1,180 @@
+// VerifyTest.cpp : Packs a small tree, checks that plan_packing gave its size, that verify_image passes it and that a cut off copy of the image fails without crashing.
+//
+// Usage: PS2ImageMakerVerifyTest [--tree PATH] [--image PATH] [--keep]
+
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <API.h>
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(path) _mkdir(path)
+#define remove_dir(path) _rmdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir(path, 0755)
+#define remove_dir(path) rmdir(path)
+#endif
+
+constexpr auto TEST_FILES = 12U;
+constexpr auto TEST_FILE_SIZE = 200 * 1024U + 123; // About 100 sectors each so the cut goes through the middle of the data
+
+struct VerifyOptions {
+    std::string tree = "verify_test_tree";
+    std::string image = "verify_test.iso";
+    bool keep = false;
+};
+
+bool parse_options(int argc, char** argv, VerifyOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--keep") {
+            options.keep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--tree") options.tree = value;
+        else if (arg == "--image") options.image = value;
+        else return false;
+    }
+    return true;
+}
+
+std::string get_file_path(const VerifyOptions& options, unsigned int i) {
+    char name[32];
+    snprintf(name, sizeof(name), "/FILE%02u.BIN", i);
+    return options.tree + name;
+}
+
+bool generate_tree(const VerifyOptions& options) {
+    make_dir(options.tree.c_str());
+    std::vector<char> data(TEST_FILE_SIZE);
+    for (unsigned int i = 0; i < TEST_FILES; ++i) {
+        for (size_t j = 0; j < data.size(); ++j) {
+            data[j] = (char)(j * 31 + i);
+        }
+        FILE* f = std::fopen(get_file_path(options, i).c_str(), "wb");
+        if (f == nullptr) {
+            return false;
+        }
+        auto written = std::fwrite(data.data(), 1, data.size(), f);
+        std::fclose(f);
+        if (written != data.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void remove_tree(const VerifyOptions& options) {
+    for (unsigned int i = 0; i < TEST_FILES; ++i) {
+        remove(get_file_path(options, i).c_str());
+    }
+    remove_dir(options.tree.c_str());
+}
+
+bool pack(const VerifyOptions& options) {
+    Progress* pr = start_packing(options.tree.c_str(), options.image.c_str());
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        pr = poll_progress();
+    } while (!pr->finished);
+    return pr->state == ProgressState::FINISHED;
+}
+
+// Sectors plan_packing lays the tree out in, 0 if it can't
+unsigned int get_planned_sectors(const VerifyOptions& options) {
+    PackingPlan* plan = plan_packing(options.tree.c_str());
+    if (plan == nullptr) {
+        return 0;
+    }
+    auto sectors = plan->total_sectors;
+    free_packing_plan(plan);
+    return sectors;
+}
+
+unsigned long long get_file_size(const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return 0;
+    }
+    std::fseek(f, 0, SEEK_END);
+    auto size = std::ftell(f);
+    std::fclose(f);
+    return size;
+}
+
+// Copy of the image with only the first sectors of it, like a download or a burn that stopped half way
+bool write_cut_image(const std::string& image, const std::string& cut_image, unsigned int& sectors) {
+    FILE* in = std::fopen(image.c_str(), "rb");
+    if (in == nullptr) {
+        return false;
+    }
+    std::fseek(in, 0, SEEK_END);
+    sectors = std::ftell(in) / 2048 / 2 + 131; // Past all the metadata, far from the end of the data
+    std::fseek(in, 0, SEEK_SET);
+    std::vector<char> data((size_t)sectors * 2048);
+    auto read = std::fread(data.data(), 1, data.size(), in);
+    std::fclose(in);
+    FILE* out = std::fopen(cut_image.c_str(), "wb");
+    if (read != data.size() || out == nullptr) {
+        if (out != nullptr) std::fclose(out);
+        return false;
+    }
+    auto written = std::fwrite(data.data(), 1, data.size(), out);
+    std::fclose(out);
+    return written == data.size();
+}
+
+int main(int argc, char** argv) {
+    VerifyOptions options;
+    if (!parse_options(argc, argv, options)) {
+        std::fprintf(stderr, "Invalid arguments, see the top of VerifyTest.cpp for usage\n");
+        return 1;
+    }
+    auto cut_image = options.image + ".cut";
+    int result = 1;
+    unsigned int cut_sectors = 0;
+    if (!generate_tree(options)) {
+        std::printf("FAILED: Can't create the tree in %s\n", options.tree.c_str());
+    }
+    else if (!pack(options)) {
+        std::printf("FAILED: Packing failed\n");
+    }
+    else if ((unsigned long long)get_planned_sectors(options) * 2048 != get_file_size(options.image)) {
+        std::printf("FAILED: Plan has %u sectors but the image is %llu bytes\n", get_planned_sectors(options), get_file_size(options.image));
+    }
+    else {
+        VerifyReport* report = verify_image(options.image.c_str(), options.tree.c_str());
+        if (!report->passed) {
+            std::printf("FAILED: Whole image doesn't verify, first errors:\n%s", report->errors);
+        }
+        else if (!write_cut_image(options.image, cut_image, cut_sectors)) {
+            std::printf("FAILED: Can't write the cut off image\n");
+        }
+        else {
+            // Files past the cut must be reported, not read
+            report = verify_image(cut_image.c_str(), options.tree.c_str());
+            if (report->passed || report->errors_amount == 0) {
+                std::printf("FAILED: Image cut at sector %u passed\n", cut_sectors);
+            }
+            else {
+                std::printf("PASSED: Image cut at sector %u failed with %u errors\n", cut_sectors, report->errors_amount);
+                result = 0;
+            }
+        }
+    }
+    if (!options.keep) {
+        remove(options.image.c_str());
+        remove(cut_image.c_str());
+        remove_tree(options);
+    }
+    return result;
+}